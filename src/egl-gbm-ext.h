@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef EGL_GBM_EXT_H
+#define EGL_GBM_EXT_H
+
+/*
+ * Entry points beyond EGL and gbm exported by the NVIDIA EGL GBM platform
+ * library, libnvidia-egl-gbm.so.1.
+ *
+ * The library is loaded by the EGL driver rather than linked into
+ * applications. Once a display exists on EGL_PLATFORM_GBM_KHR, resolve these
+ * functions with dlsym() on the handle returned by
+ * dlopen("libnvidia-egl-gbm.so.1", RTLD_LAZY | RTLD_NOLOAD).
+ *
+ * EGLDisplay arguments are the handles EGL returned for EGL_PLATFORM_GBM_KHR,
+ * and gbm_surface arguments must have an EGL window surface created on them.
+ * Unless documented otherwise, functions returning int return 0 on success
+ * or a negative errno value.
+ */
+
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <gbm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Device selection.
+ *
+ * A gbm display renders on the GPU behind its gbm_device, the one that scans
+ * frames out, and hands frames to it without a copy. Rendering on another GPU
+ * is not supported.
+ *
+ * An EGL_DEVICE_EXT platform display attribute, as in
+ * EGL_EXT_explicit_device, must name that GPU, through any of its nodes, or
+ * eglGetPlatformDisplay() fails with EGL_BAD_MATCH.
+ * eglQueryDisplayAttribEXT(EGL_DEVICE_EXT) returns the display's EGLDevice.
+ *
+ * For EGL_DEFAULT_DISPLAY, the platform opens the gbm_device itself: the
+ * device named by the EGL_GBM_DEVICE environment variable, a device node path
+ * or PCI bus id, or else the device named by EGL_DEVICE_EXT, or else one
+ * chosen by EGL_GBM_DEVICE_POLICY=round-robin, or else the first DRM device.
+ */
+
+/*
+ * Window surface lifetime.
+ *
+ * Release every gbm_bo locked from a gbm_surface before eglDestroySurface()
+ * or eglTerminate() destroys its window surface. Frames still locked then are
+ * destroyed with the surface, so they must no longer be scanned out.
+ *
+ * From then on, until a new window surface is created on the gbm_surface,
+ * gbm_surface_lock_front_buffer() returns NULL,
+ * gbm_surface_has_free_buffers() returns 0, gbm_surface_release_buffer()
+ * does nothing and the egl_gbm_surface_*() functions below return -EINVAL.
+ * Readbacks already queued still run their callbacks.
+ */
+
+/*
+ * Images of gbm_bos.
+ *
+ * eglCreateImage() accepts a gbm_bo of the display's gbm_device as an
+ * EGL_NATIVE_PIXMAP_KHR buffer. By default, each call imports the bo into a
+ * new image, owned by the caller until eglDestroyImage().
+ *
+ * When the EGL_GBM_BO_IMAGE_CACHE environment variable is set to 1, the
+ * image of a bo is created once and returned again by later calls, for
+ * applications that create and destroy an image per frame. The image is
+ * tracked through the bo's user data, see gbm_bo_set_user_data(), so only
+ * bos without user data when first imported are cached. From then on, the
+ * user data belongs to the platform until the bo is destroyed, and the
+ * application must not replace it: the cached image would be leaked when the
+ * bo is destroyed. Applications that keep their own state in the user data,
+ * such as a DRM framebuffer id, must leave the cache disabled.
+ */
+
+/* Flags for egl_gbm_surfaces_lock_front_buffers() */
+#define EGL_GBM_LOCK_LATEST_FRAME (1u << 0)
+
+/*
+ * Locks the front buffers of <count> surfaces in one call, for compositors
+ * that drive several outputs from one thread.
+ *
+ * For each surface, this processes the stream's pending events and locks a
+ * completed frame, storing it in bos[i], or NULL if the surface has no new
+ * frame or an error occurred. The buffers are released individually with
+ * gbm_surface_release_buffer().
+ *
+ * Without flags, the oldest completed frame is locked, exactly as
+ * gbm_surface_lock_front_buffer() does, so a compositor may lock some
+ * surfaces one at a time and the rest in batches. With
+ * EGL_GBM_LOCK_LATEST_FRAME, the newest completed frame is locked, and older
+ * ones are returned to the producer without being locked, as
+ * egl_gbm_surface_lock_front_buffer_before() does for frames that are due.
+ *
+ * Returns the number of buffers locked, or a negative errno value.
+ */
+int egl_gbm_surfaces_lock_front_buffers(struct gbm_surface *const *surfaces,
+                                        unsigned int count,
+                                        uint32_t flags,
+                                        struct gbm_bo **bos);
+
+/*
+ * Takes one more lock on <bo>, which must be currently locked from <surface>,
+ * so that several consumers, such as a mirrored output and a capture
+ * encoder, can each hold the same frame without copying it. Every lock,
+ * including the one taken by gbm_surface_lock_front_buffer(), is dropped by
+ * one gbm_surface_release_buffer() call, and the buffer only returns to the
+ * producer once the last lock is dropped.
+ */
+int egl_gbm_surface_add_front_buffer_lock(struct gbm_surface *surface,
+                                          struct gbm_bo *bo);
+
+/*
+ * Called when a copy queued with egl_gbm_surface_read_front_buffer() is done,
+ * with <status> 0 if the destination buffer holds the frame, or a negative
+ * errno value. It runs on an internal thread and should return quickly.
+ */
+typedef void (*egl_gbm_readback_callback)(struct gbm_bo *bo,
+                                          int status,
+                                          void *data);
+
+/*
+ * Queues a CPU copy of the frame in <bo>, which must be currently locked from
+ * <surface>, into the linear buffer <dst> of <dst_stride> bytes per row and
+ * as many rows as <bo>. The copy is made on an internal thread through
+ * gbm_bo_map(), which detiles the buffer, after waiting for rendering to the
+ * frame if gbm_surface_lock_front_buffer() didn't. <callback> is then called
+ * with <data>.
+ *
+ * The copy holds its own lock on the frame, see
+ * egl_gbm_surface_add_front_buffer_lock(), so the caller may release <bo>
+ * as soon as this returns. Note that the producer can't reuse the frame's
+ * buffer until the copy is done.
+ *
+ * Returns 0 if the copy was queued, in which case <callback> is always called
+ * once. <dst> must stay valid until then.
+ */
+int egl_gbm_surface_read_front_buffer(struct gbm_surface *surface,
+                                      struct gbm_bo *bo,
+                                      void *dst,
+                                      uint32_t dst_stride,
+                                      egl_gbm_readback_callback callback,
+                                      void *data);
+
+/*
+ * Zero-copy handoff of window surface frames to another process.
+ *
+ * Frames are sent over a connected SOCK_SEQPACKET Unix socket as the messages
+ * below, which start with their type. The first time the buffer of a surface
+ * image, or slot, is exported over a socket, an EGL_GBM_EXPORT_BUFFER message
+ * describes it and carries its plane fds as SCM_RIGHTS. The receiver imports
+ * them, for instance with gbm_bo_import(GBM_BO_IMPORT_FD_MODIFIER), replacing
+ * any buffer it held for the slot. After that, each frame only costs an
+ * EGL_GBM_EXPORT_FRAME message naming the slot.
+ *
+ * If the frame message has EGL_GBM_EXPORT_FRAME_FENCE set, it carries a
+ * sync_file fd as SCM_RIGHTS that signals once rendering to the frame has
+ * completed, and the receiver must wait for it, for instance by polling it
+ * for POLLIN, before reading the buffer. Otherwise rendering had already
+ * completed when the message was sent. Fences are sent when the driver
+ * supports EGL_ANDROID_native_fence_sync for the frame's acquire fence.
+ *
+ * The receiver hands each frame back with an EGL_GBM_EXPORT_RELEASE message
+ * echoing the frame message.
+ */
+enum egl_gbm_export_message_type {
+    EGL_GBM_EXPORT_BUFFER = 1,
+    EGL_GBM_EXPORT_FRAME = 2,
+    EGL_GBM_EXPORT_RELEASE = 3,
+};
+
+struct egl_gbm_export_buffer {
+    uint32_t type;
+    uint32_t slot;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    /* Also the number of fds sent with the message, in plane order */
+    uint32_t num_planes;
+    uint64_t modifier;
+    uint32_t strides[4];
+    uint32_t offsets[4];
+};
+
+/* Flags of EGL_GBM_EXPORT_FRAME messages */
+#define EGL_GBM_EXPORT_FRAME_FENCE (1u << 0)
+
+/* EGL_GBM_EXPORT_FRAME and EGL_GBM_EXPORT_RELEASE messages */
+struct egl_gbm_export_frame {
+    uint32_t type;
+    uint32_t slot;
+    /* Increases by one with each frame exported from the surface */
+    uint64_t sequence;
+    /* EGL_GBM_EXPORT_FRAME_* flags */
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+/*
+ * Sends <bo>, which must be currently locked from <surface>, over the socket
+ * <fd>. The export takes its own lock on the frame, so the caller may
+ * release <bo> right away; the lock is dropped when the receiver releases
+ * the frame. Returns -EBUSY if frames exported over another socket haven't
+ * all been released yet.
+ *
+ * The socket is identified by its inode, not by <fd>, so a socket may be
+ * passed as any fd that refers to it, and a new socket is recognized as such
+ * even if it reuses the fd of a closed one.
+ */
+int egl_gbm_surface_export_front_buffer(struct gbm_surface *surface,
+                                        struct gbm_bo *bo,
+                                        int fd);
+
+/*
+ * Processes the release messages pending on the export socket <fd> without
+ * blocking, releasing each frame as gbm_surface_release_buffer() would.
+ * Call it when <fd> becomes readable.
+ *
+ * Returns the number of frames released. If the receiver hung up or sent an
+ * invalid message, every frame it held is released and a negative errno
+ * value is returned; the surface may then be exported over a new socket.
+ * Close an export socket only after that, or once all its frames came back:
+ * frames still held over a closed socket are never released.
+ */
+int egl_gbm_surface_dispatch_export(struct gbm_surface *surface, int fd);
+
+/*
+ * Frame pacing. A producer sets the target presentation time of its next
+ * frame with eglPresentationTimeANDROID() before eglSwapBuffers(), in
+ * nanoseconds of CLOCK_MONOTONIC.
+ *
+ * Unlike gbm_surface_lock_front_buffer(), which locks the oldest completed
+ * frame, this locks the latest frame whose target time is no later than
+ * <deadline_ns>, such as the time of the next vblank, and returns older
+ * frames to the producer unseen. Frames without a target time are always
+ * due. Frames due later stay queued. <bo> is set to NULL if no frame is due,
+ * and <present_ns>, if not NULL, receives the locked frame's target time, or
+ * 0 if it has none.
+ */
+int egl_gbm_surface_lock_front_buffer_before(struct gbm_surface *surface,
+                                             uint64_t deadline_ns,
+                                             struct gbm_bo **bo,
+                                             uint64_t *present_ns);
+
+/*
+ * Feeds back whether the display engine can scan out <bo>, a buffer of
+ * <surface>, without a composited fallback, for instance after an atomic
+ * commit with DRM_MODE_ATOMIC_TEST_ONLY. <accepted> is nonzero if it can.
+ *
+ * When a surface is created with GBM_BO_USE_SCANOUT and a list of modifiers,
+ * the modifiers are ranked by scanout bandwidth, and those reported as
+ * rejected for the same device, format and size are left out. If one of them
+ * was reported as accepted, the surface only uses the best such modifier.
+ * The surface <bo> belongs to keeps its layout, so recreate it to apply a
+ * rejection.
+ */
+int egl_gbm_surface_report_scanout(struct gbm_surface *surface,
+                                   struct gbm_bo *bo,
+                                   int accepted);
+
+/*
+ * Returns in <sync> the fence that signals when rendering to <bo> completes.
+ * <bo> must be currently locked from <surface>.
+ *
+ * By default, gbm_surface_lock_front_buffer() waits for rendering to complete
+ * on the CPU, and <sync> is set to EGL_NO_SYNC_KHR. When the environment
+ * variable EGL_GBM_DEFER_ACQUIRE_WAIT is set to 1, it doesn't wait, and the
+ * consumer must wait on <sync> before reading <bo>. A GL consumer on the same
+ * EGLDisplay can queue the wait on the GPU with eglWaitSyncKHR(), so that
+ * neither side blocks on the CPU.
+ *
+ * The fence belongs to the EGLDisplay the window surface was created on. It
+ * is reused once <bo> is released, and must not be destroyed by the caller.
+ */
+int egl_gbm_surface_get_acquire_sync(struct gbm_surface *surface,
+                                     struct gbm_bo *bo,
+                                     EGLSyncKHR *sync);
+
+/*
+ * Memory held by window surface images.
+ *
+ * An image is sized when its gbm_bo is first imported, that is the first
+ * time it is locked with gbm_surface_lock_front_buffer(), as the sum of
+ * offset + stride x height over its planes. Images that were never locked
+ * are not counted.
+ *
+ * The images are allocated by the EGLStream behind the window surface, as
+ * many as its FIFO holds, and stay allocated until the surface is destroyed:
+ * the number of images is fixed when the stream is created, so the platform
+ * can't trim it while an output is idle, or grow it under load. To give back
+ * the memory of an output that shows a static frame for a long time, destroy
+ * its window surface and create a new one when rendering resumes.
+ */
+struct egl_gbm_memory_info {
+    /* Window surfaces included in the totals */
+    uint32_t num_surfaces;
+    /* Stream images owned by the surfaces */
+    uint32_t num_images;
+    uint64_t image_bytes;
+    /* The subset of those images with an imported gbm_bo */
+    uint32_t num_imported;
+    uint64_t imported_bytes;
+};
+
+/* Fills <info> with the memory held by the window surface on <surface> */
+int egl_gbm_surface_get_memory_info(struct gbm_surface *surface,
+                                    struct egl_gbm_memory_info *info);
+
+/* Fills <info> with the totals over all window surfaces of <dpy> */
+int egl_gbm_display_get_memory_info(EGLDisplay dpy,
+                                    struct egl_gbm_memory_info *info);
+
+/*
+ * Writes a human readable description of <dpy> and its window surfaces,
+ * including their memory, to the file descriptor <fd>.
+ */
+int egl_gbm_display_dump(EGLDisplay dpy, int fd);
+
+typedef int (*PFN_EGL_GBM_SURFACES_LOCK_FRONT_BUFFERS)(
+    struct gbm_surface *const *surfaces,
+    unsigned int count,
+    uint32_t flags,
+    struct gbm_bo **bos);
+typedef int (*PFN_EGL_GBM_SURFACE_ADD_FRONT_BUFFER_LOCK)(
+    struct gbm_surface *surface,
+    struct gbm_bo *bo);
+typedef int (*PFN_EGL_GBM_SURFACE_READ_FRONT_BUFFER)(
+    struct gbm_surface *surface,
+    struct gbm_bo *bo,
+    void *dst,
+    uint32_t dst_stride,
+    egl_gbm_readback_callback callback,
+    void *data);
+typedef int (*PFN_EGL_GBM_SURFACE_EXPORT_FRONT_BUFFER)(
+    struct gbm_surface *surface,
+    struct gbm_bo *bo,
+    int fd);
+typedef int (*PFN_EGL_GBM_SURFACE_DISPATCH_EXPORT)(
+    struct gbm_surface *surface,
+    int fd);
+typedef int (*PFN_EGL_GBM_SURFACE_LOCK_FRONT_BUFFER_BEFORE)(
+    struct gbm_surface *surface,
+    uint64_t deadline_ns,
+    struct gbm_bo **bo,
+    uint64_t *present_ns);
+typedef int (*PFN_EGL_GBM_SURFACE_REPORT_SCANOUT)(
+    struct gbm_surface *surface,
+    struct gbm_bo *bo,
+    int accepted);
+typedef int (*PFN_EGL_GBM_SURFACE_GET_ACQUIRE_SYNC)(
+    struct gbm_surface *surface,
+    struct gbm_bo *bo,
+    EGLSyncKHR *sync);
+typedef int (*PFN_EGL_GBM_SURFACE_GET_MEMORY_INFO)(
+    struct gbm_surface *surface,
+    struct egl_gbm_memory_info *info);
+typedef int (*PFN_EGL_GBM_DISPLAY_GET_MEMORY_INFO)(
+    EGLDisplay dpy,
+    struct egl_gbm_memory_info *info);
+typedef int (*PFN_EGL_GBM_DISPLAY_DUMP)(EGLDisplay dpy, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EGL_GBM_EXT_H */
@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-cache.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#define CACHE_MAGIC "EGBMCACH"
+#define CACHE_FORMAT_VERSION 1
+
+/* Refuse to read anything larger than this; it is not a file we wrote */
+#define CACHE_MAX_FILE_SIZE (1024 * 1024)
+
+#define CACHE_MAX_RECORDS 16
+
+#define PLATFORM_VERSION                        \
+    (((uint32_t)GBM_EXTERNAL_VERSION_MAJOR << 16) | \
+     ((uint32_t)GBM_EXTERNAL_VERSION_MINOR << 8) |  \
+     (uint32_t)GBM_EXTERNAL_VERSION_MICRO)
+
+/*
+ * On-disk layout. The file is only meaningful to the same driver build on the
+ * same machine, so everything is stored in native byte order.
+ */
+typedef struct CacheHeaderRec {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t platformVersion;
+    uint64_t driverIno;
+    int64_t driverSize;
+    int64_t driverMtimeSec;
+    int64_t driverMtimeNsec;
+    uint64_t extNamesHash;
+    uint32_t numRecords;
+    uint32_t pad;
+} CacheHeader;
+
+typedef struct CacheRecordRec {
+    uint64_t rdev;
+    int32_t devIndex;
+    uint32_t extsValid;
+    uint64_t exts;
+    uint32_t numConfigs;
+    uint32_t pad;
+    /* Followed by numConfigs GbmCacheConfig entries */
+} CacheRecord;
+
+static const char ExtensionTable[] =
+#define DO_EGL_EXT(_EXT) #_EXT " "
+#include "gbm-egl-extensions.h"
+#undef DO_EGL_EXT
+    ;
+
+static uint64_t
+HashString(const char* str)
+{
+    /* 64-bit FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *str; str++) {
+        hash ^= (uint8_t)*str;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool
+eGbmCacheInit(GbmPlatformData* data, const EGLExtDriver* driver)
+{
+    const char* path = getenv("EGL_GBM_CACHE_FILE");
+    struct stat statbuf;
+    Dl_info info;
+
+    data->cache.path = NULL;
+
+    if (!path || !path[0]) return false;
+
+    /*
+     * The driver has no version query that is usable before a display is
+     * initialized, so identify it by the library file that implements it.
+     * Any driver update replaces that file.
+     */
+    if (!dladdr((void*)driver->getProcAddress, &info) || !info.dli_fname)
+        return false;
+
+    if (stat(info.dli_fname, &statbuf)) return false;
+
+    data->cache.driverIno = statbuf.st_ino;
+    data->cache.driverSize = statbuf.st_size;
+    data->cache.driverMtimeSec = statbuf.st_mtim.tv_sec;
+    data->cache.driverMtimeNsec = statbuf.st_mtim.tv_nsec;
+    data->cache.extNamesHash = HashString(ExtensionTable);
+    data->cache.path = strdup(path);
+
+    return data->cache.path != NULL;
+}
+
+void
+eGbmCacheFini(GbmPlatformData* data)
+{
+    free(data->cache.path);
+    data->cache.path = NULL;
+}
+
+void
+eGbmCacheInitDevice(GbmDeviceCache* cache, dev_t rdev)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->rdev = rdev;
+    cache->devIndex = -1;
+}
+
+void
+eGbmCacheFreeDevice(GbmDeviceCache* cache)
+{
+    free(cache->configs);
+    cache->configs = NULL;
+    cache->numConfigs = 0;
+}
+
+static void
+InitHeader(const GbmPlatformData* data, CacheHeader* hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->formatVersion = CACHE_FORMAT_VERSION;
+    hdr->platformVersion = PLATFORM_VERSION;
+    hdr->driverIno = data->cache.driverIno;
+    hdr->driverSize = data->cache.driverSize;
+    hdr->driverMtimeSec = data->cache.driverMtimeSec;
+    hdr->driverMtimeNsec = data->cache.driverMtimeNsec;
+    hdr->extNamesHash = data->cache.extNamesHash;
+}
+
+/*
+ * Reads the whole cache file and validates its header against the running
+ * driver. Returns a malloc'd buffer on success.
+ */
+static uint8_t*
+ReadCacheFile(const GbmPlatformData* data, size_t* sizeOut)
+{
+    CacheHeader expected;
+    struct stat statbuf;
+    uint8_t* buf = NULL;
+    size_t size = 0;
+    ssize_t got;
+    int fd;
+
+    fd = open(data->cache.path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &statbuf) ||
+        statbuf.st_size < (off_t)sizeof(CacheHeader) ||
+        statbuf.st_size > CACHE_MAX_FILE_SIZE)
+        goto fail;
+
+    buf = malloc(statbuf.st_size);
+
+    if (!buf) goto fail;
+
+    while (size < (size_t)statbuf.st_size) {
+        got = read(fd, buf + size, statbuf.st_size - size);
+        if (got <= 0) goto fail;
+        size += got;
+    }
+
+    InitHeader(data, &expected);
+
+    /* numRecords is the only field allowed to differ */
+    expected.numRecords = ((CacheHeader*)buf)->numRecords;
+
+    if (memcmp(buf, &expected, sizeof(expected))) goto fail;
+
+    close(fd);
+    *sizeOut = size;
+
+    return buf;
+
+fail:
+    free(buf);
+    close(fd);
+
+    return NULL;
+}
+
+/*
+ * Walks the records in a validated cache file, calling <func> on each. Stops
+ * and returns false if the file is truncated or malformed.
+ */
+static bool
+ForEachRecord(const uint8_t* buf,
+              size_t size,
+              bool (*func)(const CacheRecord* rec,
+                           const GbmCacheConfig* configs,
+                           void* closure),
+              void* closure)
+{
+    const CacheHeader* hdr = (const CacheHeader*)buf;
+    const CacheRecord* rec;
+    size_t offset = sizeof(*hdr);
+    size_t configSize;
+    uint32_t i;
+
+    if (hdr->numRecords > CACHE_MAX_RECORDS) return false;
+
+    for (i = 0; i < hdr->numRecords; i++) {
+        if (size - offset < sizeof(*rec)) return false;
+
+        rec = (const CacheRecord*)(buf + offset);
+        offset += sizeof(*rec);
+
+        if (rec->numConfigs > (size - offset) / sizeof(GbmCacheConfig))
+            return false;
+
+        configSize = rec->numConfigs * sizeof(GbmCacheConfig);
+
+        if (!func(rec, (const GbmCacheConfig*)(buf + offset), closure))
+            return true;
+
+        offset += configSize;
+    }
+
+    return true;
+}
+
+static bool
+LoadRecord(const CacheRecord* rec,
+           const GbmCacheConfig* configs,
+           void* closure)
+{
+    GbmDeviceCache* cache = closure;
+
+    if (rec->rdev != (uint64_t)cache->rdev) return true;
+
+    if (rec->numConfigs) {
+        cache->configs = malloc(rec->numConfigs * sizeof(*configs));
+
+        /* Only the config table is lost; keep the rest of the record */
+        if (cache->configs) {
+            memcpy(cache->configs, configs, rec->numConfigs * sizeof(*configs));
+            cache->numConfigs = rec->numConfigs;
+        }
+    }
+
+    cache->devIndex = rec->devIndex;
+    cache->extsValid = rec->extsValid != 0;
+    cache->exts = rec->exts;
+
+    /* Found it, stop iterating */
+    return false;
+}
+
+bool
+eGbmCacheLoad(GbmPlatformData* data, GbmDeviceCache* cache)
+{
+    uint8_t* buf;
+    size_t size;
+    bool ok;
+
+    if (!data->cache.path) return false;
+
+    buf = ReadCacheFile(data, &size);
+
+    if (!buf) return false;
+
+    ok = ForEachRecord(buf, size, LoadRecord, cache);
+    free(buf);
+
+    if (!ok) {
+        /* Don't use anything from a corrupt file */
+        eGbmCacheFreeDevice(cache);
+        eGbmCacheInitDevice(cache, cache->rdev);
+        return false;
+    }
+
+    return cache->devIndex >= 0 || cache->extsValid || cache->numConfigs;
+}
+
+static bool
+WriteAll(int fd, const void* ptr, size_t size)
+{
+    const uint8_t* p = ptr;
+    ssize_t written;
+
+    while (size) {
+        written = write(fd, p, size);
+        if (written <= 0) return false;
+        p += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool
+WriteRecord(int fd, const CacheRecord* rec, const GbmCacheConfig* configs)
+{
+    return WriteAll(fd, rec, sizeof(*rec)) &&
+           WriteAll(fd, configs, rec->numConfigs * sizeof(*configs));
+}
+
+typedef struct CopyRecordsClosureRec {
+    int fd;
+    dev_t skip;
+    uint32_t count;
+    bool ok;
+} CopyRecordsClosure;
+
+static bool
+CopyRecord(const CacheRecord* rec,
+           const GbmCacheConfig* configs,
+           void* closureVoid)
+{
+    CopyRecordsClosure* closure = closureVoid;
+
+    if (rec->rdev == (uint64_t)closure->skip) return true;
+
+    /* Keep room for the record being stored */
+    if (closure->count + 1 >= CACHE_MAX_RECORDS) return false;
+
+    if (!WriteRecord(closure->fd, rec, configs)) {
+        closure->ok = false;
+        return false;
+    }
+
+    closure->count++;
+
+    return true;
+}
+
+void
+eGbmCacheStore(GbmPlatformData* data, const GbmDeviceCache* cache)
+{
+    CopyRecordsClosure closure;
+    CacheHeader hdr;
+    CacheRecord rec;
+    uint8_t* old = NULL;
+    size_t oldSize = 0;
+    char* tmpPath = NULL;
+    int fd = -1;
+
+    if (!data->cache.path) return;
+
+    if (asprintf(&tmpPath, "%s.XXXXXX", data->cache.path) < 0) {
+        tmpPath = NULL;
+        goto done;
+    }
+
+    fd = mkostemp(tmpPath, O_CLOEXEC);
+
+    if (fd < 0) goto done;
+
+    /* Write a placeholder header, then fix up the record count at the end */
+    InitHeader(data, &hdr);
+
+    if (!WriteAll(fd, &hdr, sizeof(hdr))) goto done;
+
+    /* Carry over records for other devices from a valid existing file */
+    closure.fd = fd;
+    closure.skip = cache->rdev;
+    closure.count = 0;
+    closure.ok = true;
+
+    old = ReadCacheFile(data, &oldSize);
+
+    if (old) ForEachRecord(old, oldSize, CopyRecord, &closure);
+
+    if (!closure.ok) goto done;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.rdev = cache->rdev;
+    rec.devIndex = cache->devIndex;
+    rec.extsValid = cache->extsValid;
+    rec.exts = cache->exts;
+    rec.numConfigs = cache->numConfigs;
+
+    if (!WriteRecord(fd, &rec, cache->configs)) goto done;
+
+    hdr.numRecords = closure.count + 1;
+
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) goto done;
+
+    if (close(fd)) {
+        fd = -1;
+        goto done;
+    }
+
+    fd = -1;
+
+    /* Atomically replace the old file so readers never see a partial one */
+    if (rename(tmpPath, data->cache.path)) goto done;
+
+    free(tmpPath);
+    tmpPath = NULL;
+
+done:
+    if (fd >= 0) close(fd);
+    if (tmpPath) {
+        unlink(tmpPath);
+        free(tmpPath);
+    }
+    free(old);
+}
+
+static int
+ConfigCmp(const void* elemA, const void* elemB)
+{
+    const GbmCacheConfig* a = elemA;
+    const GbmCacheConfig* b = elemB;
+
+    return (a->configId > b->configId) - (a->configId < b->configId);
+}
+
+void
+eGbmCacheSetConfigs(GbmDeviceCache* cache,
+                    GbmCacheConfig* configs,
+                    EGLint numConfigs)
+{
+    qsort(configs, numConfigs, sizeof(*configs), ConfigCmp);
+
+    free(cache->configs);
+    cache->configs = configs;
+    cache->numConfigs = numConfigs;
+}
+
+bool
+eGbmCacheLookupConfig(const GbmDeviceCache* cache,
+                      EGLint configId,
+                      uint32_t* fourcc)
+{
+    const GbmCacheConfig key = { configId, 0 };
+    const GbmCacheConfig* res;
+
+    if (!cache->numConfigs) return false;
+
+    res = bsearch(&key, cache->configs, cache->numConfigs,
+                  sizeof(*cache->configs), ConfigCmp);
+
+    if (!res) return false;
+
+    *fourcc = res->fourcc;
+
+    return true;
+}
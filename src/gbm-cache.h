@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_CACHE_H
+#define GBM_CACHE_H
+
+#include "gbm-platform.h"
+#include "gbm-utils.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Persistent cache of per-device metadata that is otherwise re-probed by
+ * every process: which EGLDevice backs a DRM device, the display extension
+ * set, and the EGLConfig to DRM fourcc mapping.
+ *
+ * The cache is opt-in and is enabled by pointing the EGL_GBM_CACHE_FILE
+ * environment variable at a writable path. Its contents are only trusted if
+ * the platform version, the driver library identity, and the extension table
+ * this library was built with all match; otherwise it is ignored and
+ * rewritten.
+ */
+
+typedef struct GbmCacheConfigRec {
+    EGLint configId;
+    uint32_t fourcc;
+} GbmCacheConfig;
+
+typedef struct GbmDeviceCacheRec {
+    dev_t rdev;
+
+    /* Index of the matching device in the eglQueryDevicesEXT() list, or -1 */
+    EGLint devIndex;
+
+    bool extsValid;
+    GbmExtensionSet exts;
+
+    /* Sorted by configId */
+    GbmCacheConfig* configs;
+    EGLint numConfigs;
+} GbmDeviceCache;
+
+bool eGbmCacheInit(GbmPlatformData* data, const EGLExtDriver* driver);
+void eGbmCacheFini(GbmPlatformData* data);
+
+void eGbmCacheInitDevice(GbmDeviceCache* cache, dev_t rdev);
+bool eGbmCacheLoad(GbmPlatformData* data, GbmDeviceCache* cache);
+void eGbmCacheStore(GbmPlatformData* data, const GbmDeviceCache* cache);
+void eGbmCacheFreeDevice(GbmDeviceCache* cache);
+
+/* Takes ownership of <configs>, which must have been allocated with malloc() */
+void eGbmCacheSetConfigs(GbmDeviceCache* cache,
+                         GbmCacheConfig* configs,
+                         EGLint numConfigs);
+bool eGbmCacheLookupConfig(const GbmDeviceCache* cache,
+                           EGLint configId,
+                           uint32_t* fourcc);
+
+#endif /* GBM_CACHE_H */
@@ -7,19 +7,25 @@
 #include "gbm-display.h"
 #include "gbm-utils.h"
 #include "gbm-surface.h"
+#include "gbm-image.h"
+#include "gbm-stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <gbm.h>
 #include <gbmint.h>
 #include <xf86drm.h>
 #include <drm_fourcc.h>
+#include <errno.h>
+#include <inttypes.h>
 
 #if !defined(O_CLOEXEC)
 #if ((defined(__sun__) && defined(__svr4__)) || defined(__SUNPRO_C) || defined(__SUNPRO_CC))
@@ -54,32 +60,37 @@ CheckDevicePath(const GbmPlatformData* data,
     return true;
 }
 
+static bool
+DeviceMatches(const GbmPlatformData* data, EGLDeviceEXT dev, dev_t gbmDev)
+{
+    GbmExtensionSet devExts =
+        eGbmParseExtensions(data->egl.QueryDeviceStringEXT(dev,
+                                                           EGL_EXTENSIONS));
+
+    if (!eGbmHasExtension(devExts, GBM_EGL_EXT_device_drm)) return false;
+
+    if (CheckDevicePath(data, dev, EGL_DRM_DEVICE_FILE_EXT, gbmDev))
+        return true;
+
+    if (!eGbmHasExtension(devExts, GBM_EGL_EXT_device_drm_render_node))
+        return false;
+
+    return CheckDevicePath(data, dev, EGL_DRM_RENDER_NODE_FILE_EXT, gbmDev);
+}
+
+/*
+ * Finds the EGLDevice for the DRM device <rdev>, trying the device recorded in
+ * the persistent cache first.
+ */
 static EGLDeviceEXT
-FindGbmDevice(GbmPlatformData* data, struct gbm_device* gbm)
+FindEglDevice(GbmDisplay* display, dev_t rdev)
 {
+    GbmPlatformData* data = display->data;
     EGLDeviceEXT* devs = NULL;
-    const char* devExts;
-    struct stat statbuf;
     EGLDeviceEXT dev = EGL_NO_DEVICE_EXT;
     EGLint maxDevs, numDevs;
-    int gbmFd = gbm_device_get_fd(gbm);
     int i;
 
-    if (gbmFd < 0) {
-        /*
-         * No need to set an error here or various other cases that boil down
-         * to an invalid native display. From the EGL 1.5 spec:
-         *
-         * "If platform is valid but no display matching <native_display> is
-         * available, then EGL_NO_DISPLAY is returned; no error condition is
-         * raised in this case."
-         */
-        goto done;
-    }
-
-    memset(&statbuf, 0, sizeof(statbuf));
-    if (fstat(gbmFd, &statbuf)) goto done;
-
     if (data->egl.QueryDevicesEXT(0, NULL, &maxDevs) != EGL_TRUE) goto done;
 
     if (maxDevs <= 0) goto done;
@@ -94,29 +105,24 @@ FindGbmDevice(GbmPlatformData* data, struct gbm_device* gbm)
     if (data->egl.QueryDevicesEXT(maxDevs, devs, &numDevs) != EGL_TRUE)
         goto done;
 
-    for (i = 0; i < numDevs; i++) {
-        devExts = data->egl.QueryDeviceStringEXT(devs[i], EGL_EXTENSIONS);
+    /* Try the device that matched last time before scanning them all */
+    i = display->cache.devIndex;
 
-        if (!eGbmFindExtension("EGL_EXT_device_drm", devExts)) continue;
+    if (i >= 0 && i < numDevs && DeviceMatches(data, devs[i], rdev)) {
+        dev = devs[i];
+        goto done;
+    }
 
-        if (CheckDevicePath(data,
-                            devs[i],
-                            EGL_DRM_DEVICE_FILE_EXT,
-                            statbuf.st_rdev)) {
+    for (i = 0; i < numDevs; i++) {
+        if (DeviceMatches(data, devs[i], rdev)) {
             dev = devs[i];
             break;
         }
+    }
 
-        if (!eGbmFindExtension("EGL_EXT_device_drm_render_node", devExts))
-            continue;
-
-        if (CheckDevicePath(data,
-                            devs[i],
-                            EGL_DRM_RENDER_NODE_FILE_EXT,
-                            statbuf.st_rdev)) {
-            dev = devs[i];
-            break;
-        }
+    if (dev != EGL_NO_DEVICE_EXT && data->cache.path) {
+        display->cache.devIndex = i;
+        display->cacheDirty = true;
     }
 
 done:
@@ -126,33 +132,250 @@ done:
 
 }
 
+static bool
+GetGbmDeviceRdev(struct gbm_device* gbm, dev_t* rdev)
+{
+    struct stat statbuf;
+    int gbmFd = gbm_device_get_fd(gbm);
+
+    if (gbmFd < 0) {
+        /*
+         * No need to set an error here or various other cases that boil down
+         * to an invalid native display. From the EGL 1.5 spec:
+         *
+         * "If platform is valid but no display matching <native_display> is
+         * available, then EGL_NO_DISPLAY is returned; no error condition is
+         * raised in this case."
+         */
+        return false;
+    }
+
+    memset(&statbuf, 0, sizeof(statbuf));
+    if (fstat(gbmFd, &statbuf)) return false;
+
+    *rdev = statbuf.st_rdev;
+
+    return true;
+}
+
+static void BuildConfigFourCCTable(GbmDisplay* display);
+
+#define PCI_VENDOR_ID_NVIDIA 0x10de
+
+static int
+OpenDrmDeviceNodes(drmDevicePtr device)
+{
+    int fd = -1;
+
+    if (device->nodes[DRM_NODE_RENDER] &&
+        (device->available_nodes & (1 << DRM_NODE_RENDER)))
+        fd = open(device->nodes[DRM_NODE_RENDER], O_RDWR | O_CLOEXEC);
+
+    if ((fd < 0) && device->nodes[DRM_NODE_PRIMARY] &&
+        (device->available_nodes & (1 << DRM_NODE_PRIMARY)))
+        fd = open(device->nodes[DRM_NODE_PRIMARY], O_RDWR | O_CLOEXEC);
+
+    return fd;
+}
+
+static bool
+IsNvidiaDrmDevice(drmDevicePtr device)
+{
+    return device->bustype == DRM_BUS_PCI &&
+           device->deviceinfo.pci->vendor_id == PCI_VENDOR_ID_NVIDIA;
+}
+
+/*
+ * Matches <device> against a PCI bus id of the form
+ * [pci-][<domain>:]<bus>:<device>.<function>, all in hex.
+ */
+static bool
+MatchPciBusId(drmDevicePtr device, const char *busId)
+{
+    unsigned int domain = 0, bus, dev, func;
+
+    if (device->bustype != DRM_BUS_PCI) return false;
+
+    if (!strncmp(busId, "pci-", 4)) busId += 4;
+
+    if (sscanf(busId, "%x:%x:%x.%x", &domain, &bus, &dev, &func) != 4) {
+        domain = 0;
+        if (sscanf(busId, "%x:%x.%x", &bus, &dev, &func) != 3) return false;
+    }
+
+    return device->businfo.pci->domain == domain &&
+           device->businfo.pci->bus == bus &&
+           device->businfo.pci->dev == dev &&
+           device->businfo.pci->func == func;
+}
+
 static int
-OpenDefaultDrmDevice(void)
+OpenEglDevice(GbmPlatformData* data, EGLDeviceEXT dev)
 {
-    drmDevicePtr devices[1];
-    int numDevices = drmGetDevices2(0, devices, 1);
+    const char *path;
     int fd = -1;
 
-    if (numDevices == 0)
+    path = data->egl.QueryDeviceStringEXT(dev, EGL_DRM_RENDER_NODE_FILE_EXT);
+
+    if (path) fd = open(path, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        path = data->egl.QueryDeviceStringEXT(dev, EGL_DRM_DEVICE_FILE_EXT);
+        if (path) fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+
+    return fd;
+}
+
+/*
+ * Returns the device named by an EGL_DEVICE_EXT platform display attribute
+ * (EGL_EXT_explicit_device), or EGL_NO_DEVICE_EXT.
+ */
+static EGLDeviceEXT
+GetExplicitDevice(const EGLAttrib* attribs)
+{
+    int i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i] == EGL_DEVICE_EXT) return (EGLDeviceEXT)attribs[i + 1];
+    }
+
+    return EGL_NO_DEVICE_EXT;
+}
+
+/*
+ * Picks the DRM device backing EGL_DEFAULT_DISPLAY, which scans frames out.
+ * In order of precedence:
+ *
+ *  - The EGL_GBM_DEVICE environment variable, naming either a device node
+ *    path or a PCI bus id
+ *  - The device named by an EGL_DEVICE_EXT platform display attribute
+ *    (EGL_EXT_explicit_device)
+ *  - EGL_GBM_DEVICE_POLICY=round-robin, which spreads processes and
+ *    successive default displays across all NVIDIA devices
+ *  - Otherwise, the first device enumerated
+ */
+static int
+OpenDefaultDrmDevice(GbmPlatformData* data, const EGLAttrib *attribs)
+{
+    static unsigned int roundRobinCounter;
+    drmDevicePtr *devices = NULL;
+    const char *selection = getenv("EGL_GBM_DEVICE");
+    const char *policy = getenv("EGL_GBM_DEVICE_POLICY");
+    int numDevices;
+    int numCandidates = 0;
+    int pick;
+    int fd = -1;
+    int i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i] == EGL_DEVICE_EXT && !(selection && selection[0]))
+            return OpenEglDevice(data, (EGLDeviceEXT)attribs[i + 1]);
+    }
+
+    if (selection && selection[0] == '/')
+        return open(selection, O_RDWR | O_CLOEXEC);
+
+    numDevices = drmGetDevices2(0, NULL, 0);
+
+    if (numDevices <= 0)
         return -1;
 
-    if (devices[0]->nodes[DRM_NODE_RENDER])
-        fd = open(devices[0]->nodes[DRM_NODE_RENDER], O_RDWR | O_CLOEXEC);
+    devices = calloc(numDevices, sizeof(*devices));
+
+    if (!devices)
+        return -1;
+
+    numDevices = drmGetDevices2(0, devices, numDevices);
+
+    if (numDevices <= 0) {
+        free(devices);
+        return -1;
+    }
+
+    if (selection && selection[0]) {
+        for (i = 0; i < numDevices; i++) {
+            if (MatchPciBusId(devices[i], selection)) {
+                fd = OpenDrmDeviceNodes(devices[i]);
+                break;
+            }
+        }
+
+        /* An explicit selection that matches nothing is an error */
+        goto done;
+    }
+
+    if (!policy || strcasecmp(policy, "round-robin")) {
+        fd = OpenDrmDeviceNodes(devices[0]);
+        goto done;
+    }
+
+    for (i = 0; i < numDevices; i++) {
+        if (IsNvidiaDrmDevice(devices[i])) numCandidates++;
+    }
 
-    if ((fd < 0) && devices[0]->nodes[DRM_NODE_PRIMARY])
-        fd = open(devices[0]->nodes[DRM_NODE_PRIMARY], O_RDWR | O_CLOEXEC);
+    if (numCandidates == 0) {
+        /* Not a PCI system, e.g. Tegra */
+        fd = OpenDrmDeviceNodes(devices[0]);
+        goto done;
+    }
 
-    drmFreeDevices(devices, 1);
+    /*
+     * Offset by the process ID so that concurrently started processes, each
+     * opening a single default display, land on different devices.
+     */
+    pick = (getpid() +
+            __atomic_fetch_add(&roundRobinCounter, 1, __ATOMIC_RELAXED)) %
+           numCandidates;
+
+    for (i = 0; i < numDevices; i++) {
+        if (!IsNvidiaDrmDevice(devices[i])) continue;
+
+        if (pick-- == 0) {
+            fd = OpenDrmDeviceNodes(devices[i]);
+            break;
+        }
+    }
+
+done:
+    drmFreeDevices(devices, numDevices);
+    free(devices);
 
     return fd;
 }
 
+static void
+FlushConfigCache(GbmDisplay* display)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&display->configCache.mutex);
+
+    for (i = 0; i < ARRAY_LEN(display->configCache.entries); i++) {
+        free(display->configCache.entries[i].configs);
+        display->configCache.entries[i].configs = NULL;
+        display->configCache.entries[i].valid = false;
+    }
+
+    display->configCache.next = 0;
+
+    pthread_mutex_unlock(&display->configCache.mutex);
+}
+
 static void
 FreeDisplay(GbmObject* obj)
 {
     if (obj) {
         GbmDisplay* display = (GbmDisplay*)obj;
 
+        EGBM_STAT_ADD(displays, -1);
+        FlushConfigCache(display);
+        pthread_mutex_destroy(&display->configCache.mutex);
+        pthread_mutex_destroy(&display->objects.mutex);
+        pthread_mutex_destroy(&display->images.mutex);
+        free(display->configFourCCs);
+        eGbmCacheFreeDevice(&display->cache);
+
         /*
          * The device file is only opened when the display is
          * EGL_DEFAULT_DISPLAY, and is the first resource created by that code
@@ -180,8 +403,8 @@ eGbmGetPlatformDisplayExport(void *dataVoid,
     GbmPlatformData* data = dataVoid;
     GbmDisplay* display = NULL;
     const EGLAttrib *attrs = data->supportsDisplayReference ? refAttrs : NULL;
-
-    (void)attribs;
+    EGLDeviceEXT explicitDev;
+    dev_t gbmRdev;
 
     if (platform != EGL_PLATFORM_GBM_KHR) {
         eGbmSetError(data, EGL_BAD_PARAMETER);
@@ -195,6 +418,30 @@ eGbmGetPlatformDisplayExport(void *dataVoid,
         return EGL_NO_DISPLAY;
     }
 
+    if (pthread_mutex_init(&display->configCache.mutex, NULL)) {
+        free(display);
+        eGbmSetError(data, EGL_BAD_ALLOC);
+        return EGL_NO_DISPLAY;
+    }
+
+    if (pthread_mutex_init(&display->objects.mutex, NULL)) {
+        pthread_mutex_destroy(&display->configCache.mutex);
+        free(display);
+        eGbmSetError(data, EGL_BAD_ALLOC);
+        return EGL_NO_DISPLAY;
+    }
+
+    if (pthread_mutex_init(&display->images.mutex, NULL)) {
+        pthread_mutex_destroy(&display->objects.mutex);
+        pthread_mutex_destroy(&display->configCache.mutex);
+        free(display);
+        eGbmSetError(data, EGL_BAD_ALLOC);
+        return EGL_NO_DISPLAY;
+    }
+
+    /* From here on, the display is freed by FreeDisplay() */
+    EGBM_STAT_ADD(displays, 1);
+
     display->base.dpy = display;
     display->base.type = EGL_OBJECT_DISPLAY_KHR;
     display->base.refCount = 1;
@@ -204,7 +451,8 @@ eGbmGetPlatformDisplayExport(void *dataVoid,
     display->gbm = nativeDpy;
 
     if (nativeDpy == EGL_DEFAULT_DISPLAY) {
-        if ((display->fd = OpenDefaultDrmDevice()) < 0) goto fail;
+        if ((display->fd = OpenDefaultDrmDevice(data, attribs)) < 0)
+            goto fail;
         if (!(display->gbm = gbm_create_device(display->fd))) goto fail;
     }
 
@@ -219,10 +467,32 @@ eGbmGetPlatformDisplayExport(void *dataVoid,
         }
     }
 
-    display->dev = FindGbmDevice(data, display->gbm);
+    if (!GetGbmDeviceRdev(display->gbm, &gbmRdev)) goto fail;
+
+    display->gbmRdev = gbmRdev;
+
+    /*
+     * Frames are handed to the gbm device without a copy, so they must be
+     * rendered on its GPU. An explicit device may name any node of that GPU.
+     */
+    explicitDev = GetExplicitDevice(attribs);
+
+    if (explicitDev != EGL_NO_DEVICE_EXT &&
+        !DeviceMatches(data, explicitDev, gbmRdev)) {
+        eGbmSetError(data, EGL_BAD_MATCH);
+        goto fail;
+    }
+
+    eGbmCacheInitDevice(&display->cache, gbmRdev);
+    eGbmCacheLoad(data, &display->cache);
+
+    if (explicitDev != EGL_NO_DEVICE_EXT)
+        display->dev = explicitDev;
+    else
+        display->dev = FindEglDevice(display, gbmRdev);
 
     if (display->dev == EGL_NO_DEVICE_EXT) {
-        /* FindGbmDevice() sets an appropriate EGL error on failure */
+        /* FindEglDevice() sets an appropriate EGL error on failure */
         goto fail;
     }
 
@@ -253,7 +523,6 @@ eGbmInitializeHook(EGLDisplay dpy, EGLint* major, EGLint* minor)
 {
     GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
     GbmPlatformData* data;
-    const char* exts;
     EGLBoolean res;
 
     if (!display) {
@@ -267,20 +536,43 @@ eGbmInitializeHook(EGLDisplay dpy, EGLint* major, EGLint* minor)
 
     if (!res) goto done;
 
-    exts = data->egl.QueryString(display->devDpy, EGL_EXTENSIONS);
+    if (display->cache.extsValid) {
+        display->exts = display->cache.exts;
+    } else if (!display->exts) {
+        /* The driver's extensions don't change across eglTerminate */
+        display->exts =
+            eGbmParseExtensions(data->egl.QueryString(display->devDpy,
+                                                      EGL_EXTENSIONS));
+
+        if (data->cache.path) {
+            display->cache.exts = display->exts;
+            display->cache.extsValid = true;
+            display->cacheDirty = true;
+        }
+    }
 
-    if (!exts ||
-        !eGbmFindExtension("EGL_KHR_stream", exts) ||
-        !eGbmFindExtension("EGL_KHR_stream_producer_eglsurface", exts) ||
-        !eGbmFindExtension("EGL_KHR_image_base", exts) ||
-        !eGbmFindExtension("EGL_NV_stream_consumer_eglimage", exts) ||
-        !eGbmFindExtension("EGL_MESA_image_dma_buf_export", exts) ||
-        !eGbmFindExtension("EGL_EXT_sync_reuse", exts)) {
+    if (!eGbmHasExtension(display->exts, GBM_EGL_KHR_stream) ||
+        !eGbmHasExtension(display->exts,
+                          GBM_EGL_KHR_stream_producer_eglsurface) ||
+        !eGbmHasExtension(display->exts, GBM_EGL_KHR_image_base) ||
+        !eGbmHasExtension(display->exts,
+                          GBM_EGL_NV_stream_consumer_eglimage) ||
+        !eGbmHasExtension(display->exts, GBM_EGL_MESA_image_dma_buf_export) ||
+        !eGbmHasExtension(display->exts, GBM_EGL_EXT_sync_reuse)) {
         data->egl.Terminate(display->devDpy);
         eGbmSetError(data, EGL_NOT_INITIALIZED);
         res = EGL_FALSE;
     }
 
+    if (res && data->cache.path) {
+        BuildConfigFourCCTable(display);
+
+        if (display->cacheDirty) {
+            eGbmCacheStore(data, &display->cache);
+            display->cacheDirty = false;
+        }
+    }
+
     display->gbm->v0.surface_lock_front_buffer = eGbmSurfaceLockFrontBuffer;
     display->gbm->v0.surface_release_buffer = eGbmSurfaceReleaseBuffer;
     display->gbm->v0.surface_has_free_buffers = eGbmSurfaceHasFreeBuffers;
@@ -290,6 +582,54 @@ done:
     return res;
 }
 
+EGLBoolean
+eGbmQueryDisplayAttribHook(EGLDisplay dpy,
+                           EGLint name,
+                           EGLAttrib *value)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    GbmPlatformData* data;
+    EGLBoolean ret = EGL_FALSE;
+
+    if (!display) {
+        /*  No platform data. Can't set error EGL_NO_DISPLAY */
+        return EGL_FALSE;
+    }
+
+    data = display->data;
+
+    if (!value) {
+        eGbmSetError(data, EGL_BAD_PARAMETER);
+        goto done;
+    }
+
+    switch (name) {
+    case EGL_DEVICE_EXT:
+        /*
+         * The EGLDevice of the gbm device's GPU, as with
+         * EGL_EXT_explicit_device. It was located when the display was
+         * created, so there is no need for the application to enumerate
+         * devices again.
+         */
+        *value = (EGLAttrib)display->dev;
+        ret = EGL_TRUE;
+        break;
+
+    default:
+        /* Everything else, e.g. EGL_TRACK_REFERENCES_KHR, is the driver's */
+        if (data->egl.QueryDisplayAttribEXT) {
+            ret = data->egl.QueryDisplayAttribEXT(display->devDpy, name, value);
+        } else {
+            eGbmSetError(data, EGL_BAD_ATTRIBUTE);
+        }
+        break;
+    }
+
+done:
+    eGbmUnrefObject(&display->base);
+    return ret;
+}
+
 EGLBoolean
 eGbmTerminateHook(EGLDisplay dpy)
 {
@@ -301,6 +641,23 @@ eGbmTerminateHook(EGLDisplay dpy)
         return EGL_FALSE;
     }
 
+    /*
+     * Terminating invalidates every surface of the display. Reclaim them,
+     * and finish any deferred teardown, before the driver's objects go away
+     * with the display.
+     */
+    eGbmSurfacesTerminate(display);
+    eGbmDestroyListHandles(&display->objects);
+    eGbmImagesTerminate(display);
+    eGbmWorkerFlush(&display->data->readbackWorker);
+    eGbmWorkerFlush(&display->data->worker);
+
+    /* EGLConfig handles are not guaranteed to survive re-initialization */
+    FlushConfigCache(display);
+    free(display->configFourCCs);
+    display->configFourCCs = NULL;
+    display->numConfigFourCCs = 0;
+
     res = display->data->egl.Terminate(display->devDpy);
 
     eGbmUnrefObject(&display->base);
@@ -312,13 +669,20 @@ eGbmQueryStringExport(void *data,
                       EGLDisplay dpy,
                       EGLExtPlatformString name)
 {
-    (void)data;
+    GbmPlatformData* platformData = data;
+
     (void)dpy;
 
     switch (name) {
     case EGL_EXT_PLATFORM_PLATFORM_CLIENT_EXTENSIONS:
         return "EGL_KHR_platform_gbm EGL_MESA_platform_gbm";
 
+    case EGL_EXT_PLATFORM_DISPLAY_EXTENSIONS:
+        /* See eGbmPresentationTimeHook() */
+        if (platformData && platformData->egl.QueryStreamu64KHR)
+            return "EGL_ANDROID_presentation_time";
+        break;
+
     default:
         break;
     }
@@ -375,7 +739,7 @@ done:
     return res;
 }
 
-static uint32_t ConfigToDrmFourCC(GbmDisplay* display, EGLConfig config)
+static uint32_t ProbeConfigDrmFourCC(GbmDisplay* display, EGLConfig config)
 {
     EGLDisplay dpy = display->devDpy;
     EGLint r, g, b, a, componentType;
@@ -449,6 +813,169 @@ static uint32_t ConfigToDrmFourCC(GbmDisplay* display, EGLConfig config)
     }
 }
 
+static int
+ConfigFourCCCmp(const void* elemA, const void* elemB)
+{
+    const GbmConfigFourCC* a = elemA;
+    const GbmConfigFourCC* b = elemB;
+
+    return (a->config > b->config) - (a->config < b->config);
+}
+
+static uint32_t ConfigToDrmFourCC(GbmDisplay* display, EGLConfig config)
+{
+    const GbmConfigFourCC key = { config, 0 };
+    const GbmConfigFourCC* res = NULL;
+
+    if (display->numConfigFourCCs) {
+        res = bsearch(&key,
+                      display->configFourCCs,
+                      display->numConfigFourCCs,
+                      sizeof(*display->configFourCCs),
+                      ConfigFourCCCmp);
+    }
+
+    return res ? res->fourcc : ProbeConfigDrmFourCC(display, config);
+}
+
+/*
+ * Builds the per-display EGLConfig to fourcc table. Configs found in the
+ * persistent cache cost a single EGL_CONFIG_ID query rather than a full
+ * probe. If any config had to be probed, the cached table is replaced.
+ */
+static void
+BuildConfigFourCCTable(GbmDisplay* display)
+{
+    GbmPlatformData* data = display->data;
+    EGLDisplay dpy = display->devDpy;
+    EGLConfig* configs = NULL;
+    GbmConfigFourCC* table = NULL;
+    GbmCacheConfig* cached = NULL;
+    EGLint numConfigs = 0;
+    EGLint configId;
+    EGLint i;
+    bool probed = false;
+
+    if (display->configFourCCs) return;
+
+    if (!data->egl.GetConfigs(dpy, NULL, 0, &numConfigs) || numConfigs <= 0)
+        return;
+
+    configs = malloc(numConfigs * sizeof(*configs));
+    table = malloc(numConfigs * sizeof(*table));
+    cached = malloc(numConfigs * sizeof(*cached));
+
+    if (!configs || !table || !cached) goto done;
+
+    if (!data->egl.GetConfigs(dpy, configs, numConfigs, &numConfigs))
+        goto done;
+
+    for (i = 0; i < numConfigs; i++) {
+        if (!data->egl.GetConfigAttrib(dpy, configs[i], EGL_CONFIG_ID,
+                                       &configId))
+            goto done;
+
+        table[i].config = configs[i];
+        cached[i].configId = configId;
+
+        if (!eGbmCacheLookupConfig(&display->cache, configId,
+                                   &table[i].fourcc)) {
+            table[i].fourcc = ProbeConfigDrmFourCC(display, configs[i]);
+            probed = true;
+        }
+
+        cached[i].fourcc = table[i].fourcc;
+    }
+
+    qsort(table, numConfigs, sizeof(*table), ConfigFourCCCmp);
+
+    if (probed) {
+        eGbmCacheSetConfigs(&display->cache, cached, numConfigs);
+        display->cacheDirty = true;
+        cached = NULL;
+    }
+
+    display->configFourCCs = table;
+    display->numConfigFourCCs = numConfigs;
+    table = NULL;
+
+done:
+    free(configs);
+    free(table);
+    free(cached);
+}
+
+static bool
+LookupConfigCache(GbmDisplay* display,
+                  const EGLint* attribs,
+                  EGLint nAttribs,
+                  EGLint nativeVisual,
+                  EGLConfig* configs,
+                  EGLint configSize,
+                  EGLint* numConfig)
+{
+    const GbmConfigCacheEntry* entry;
+    bool found = false;
+    EGLint i;
+    unsigned int e;
+
+    pthread_mutex_lock(&display->configCache.mutex);
+
+    for (e = 0; e < ARRAY_LEN(display->configCache.entries); e++) {
+        entry = &display->configCache.entries[e];
+
+        if (!entry->valid ||
+            entry->nativeVisual != nativeVisual ||
+            memcmp(entry->attribs, attribs, (nAttribs + 1) * sizeof(*attribs)))
+            continue;
+
+        if (!configs) {
+            *numConfig = entry->numConfigs;
+        } else {
+            for (i = 0; i < entry->numConfigs && i < configSize; i++)
+                configs[i] = entry->configs[i];
+            *numConfig = i;
+        }
+
+        found = true;
+        break;
+    }
+
+    pthread_mutex_unlock(&display->configCache.mutex);
+
+    return found;
+}
+
+/*
+ * Takes ownership of <allConfigs>, which must have been allocated with
+ * malloc().
+ */
+static void
+InsertConfigCache(GbmDisplay* display,
+                  const EGLint* attribs,
+                  EGLint nAttribs,
+                  EGLint nativeVisual,
+                  EGLConfig* allConfigs,
+                  EGLint numConfigs)
+{
+    GbmConfigCacheEntry* entry;
+
+    pthread_mutex_lock(&display->configCache.mutex);
+
+    entry = &display->configCache.entries[display->configCache.next];
+    display->configCache.next =
+        (display->configCache.next + 1) % ARRAY_LEN(display->configCache.entries);
+
+    free(entry->configs);
+    memcpy(entry->attribs, attribs, (nAttribs + 1) * sizeof(*attribs));
+    entry->nativeVisual = nativeVisual;
+    entry->configs = allConfigs;
+    entry->numConfigs = numConfigs;
+    entry->valid = true;
+
+    pthread_mutex_unlock(&display->configCache.mutex);
+}
+
 EGLBoolean
 eGbmChooseConfigHook(EGLDisplay dpy,
                      EGLint const* attribs,
@@ -458,11 +985,12 @@ eGbmChooseConfigHook(EGLDisplay dpy,
 {
     GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
     GbmPlatformData* data;
-    EGLint *newAttribs = NULL;
-    EGLConfig *newConfigs = NULL;
+    EGLint localAttribs[GBM_CONFIG_CACHE_MAX_ATTRIBS];
+    EGLint *newAttribs = localAttribs;
+    EGLConfig *allConfigs = NULL;
     EGLint nAttribs = 0;
     EGLint nNewAttribs = 0;
-    EGLint nNewConfigs = 0;
+    EGLint nAllConfigs = 0;
     EGLint cfg;
     EGLint nativeVisual = EGL_DONT_CARE;
     EGLint err = EGL_SUCCESS;
@@ -477,6 +1005,11 @@ eGbmChooseConfigHook(EGLDisplay dpy,
 
     data = display->data;
 
+    if (!numConfig) {
+        err = EGL_BAD_PARAMETER;
+        goto done;
+    }
+
     if (attribs) {
         for (; attribs[nAttribs] != EGL_NONE; nAttribs += 2) {
             surfType = surfType || (attribs[nAttribs] == EGL_SURFACE_TYPE);
@@ -494,15 +1027,21 @@ eGbmChooseConfigHook(EGLDisplay dpy,
     nNewAttribs = (surfType ? nAttribs : nAttribs + 2);
     nNewAttribs = (nativeVisualID ? nNewAttribs - 2 : nNewAttribs);
 
-    newAttribs = malloc((nNewAttribs + 1) * sizeof(*newAttribs));
+    /*
+     * Lists that fit in the config cache are canonicalized on the stack so
+     * that a cache hit does not allocate.
+     */
+    if (nNewAttribs + 1 > (EGLint)ARRAY_LEN(localAttribs)) {
+        newAttribs = malloc((nNewAttribs + 1) * sizeof(*newAttribs));
 
-    if (!newAttribs) {
-        err = EGL_BAD_ALLOC;
-        goto done;
+        if (!newAttribs) {
+            err = EGL_BAD_ALLOC;
+            goto done;
+        }
     }
 
     for (nAttribs = 0, nNewAttribs = 0;
-         attribs[nAttribs] != EGL_NONE;
+         attribs && attribs[nAttribs] != EGL_NONE;
          nAttribs += 2) {
         /*
          * Convert all instances of EGL_WINDOW_BIT in an EGL_SURFACE_TYPE
@@ -545,61 +1084,74 @@ eGbmChooseConfigHook(EGLDisplay dpy,
 
     newAttribs[nNewAttribs] = EGL_NONE;
 
-    if (nativeVisual != EGL_DONT_CARE) {
-        /*
-         * Need to query *all* configs that match everything but the specified
-         * native visual ID, then filter them down based on visual ID before
-         * clamping to the number of configs requested.
-         */
-        ret = data->egl.ChooseConfig(display->devDpy,
-                                     newAttribs,
-                                     NULL,
-                                     0,
-                                     &nNewConfigs);
+    if (newAttribs == localAttribs &&
+        LookupConfigCache(display, newAttribs, nNewAttribs, nativeVisual,
+                          configs, configSize, numConfig)) {
+        ret = EGL_TRUE;
+        goto done;
+    }
 
-        if (!ret || !*numConfig) goto done;
+    /*
+     * Query *all* configs that match everything but the specified native
+     * visual ID, then filter them down based on visual ID before clamping to
+     * the number of configs requested. The full list is what gets cached.
+     */
+    ret = data->egl.ChooseConfig(display->devDpy,
+                                 newAttribs,
+                                 NULL,
+                                 0,
+                                 &nAllConfigs);
 
-        newConfigs = malloc(sizeof(EGLConfig) * *numConfig);
+    if (!ret) goto done;
 
-        if (!newConfigs) {
+    if (nAllConfigs > 0) {
+        allConfigs = malloc(sizeof(EGLConfig) * nAllConfigs);
+
+        if (!allConfigs) {
             err = EGL_BAD_ALLOC;
+            ret = EGL_FALSE;
             goto done;
         }
 
         ret = data->egl.ChooseConfig(display->devDpy,
                                      newAttribs,
-                                     newConfigs,
-                                     nNewConfigs,
-                                     &nNewConfigs);
+                                     allConfigs,
+                                     nAllConfigs,
+                                     &nAllConfigs);
 
         if (!ret) goto done;
+    }
 
-        for (cfg = 0, *numConfig = 0;
-             cfg < nNewConfigs && (!configs || *numConfig < configSize);
-             cfg++) {
-            if (ConfigToDrmFourCC(display, newConfigs[cfg]) !=
+    if (nativeVisual != EGL_DONT_CARE) {
+        EGLint nMatching = 0;
+
+        for (cfg = 0; cfg < nAllConfigs; cfg++) {
+            if (ConfigToDrmFourCC(display, allConfigs[cfg]) ==
                 (uint32_t)nativeVisual) {
-                continue;
+                allConfigs[nMatching++] = allConfigs[cfg];
             }
+        }
 
-            if (!configs) {
-                (*numConfig)++;
-                continue;
-            }
+        nAllConfigs = nMatching;
+    }
 
-            configs[(*numConfig)++] = newConfigs[cfg];
-        }
+    if (!configs) {
+        *numConfig = nAllConfigs;
     } else {
-        ret = data->egl.ChooseConfig(display->devDpy,
-                                     newAttribs,
-                                     configs,
-                                     configSize,
-                                     numConfig);
+        for (cfg = 0; cfg < nAllConfigs && cfg < configSize; cfg++)
+            configs[cfg] = allConfigs[cfg];
+        *numConfig = cfg;
+    }
+
+    if (newAttribs == localAttribs) {
+        InsertConfigCache(display, newAttribs, nNewAttribs, nativeVisual,
+                          allConfigs, nAllConfigs);
+        allConfigs = NULL;
     }
 
 done:
-    free(newAttribs);
-    free(newConfigs);
+    if (newAttribs != localAttribs) free(newAttribs);
+    free(allConfigs);
     if (err != EGL_SUCCESS) eGbmSetError(data, err);
 
     eGbmUnrefObject(&display->base);
@@ -649,3 +1201,59 @@ eGbmGetConfigAttribHook(EGLDisplay dpy,
 
     return ret;
 }
+
+static GbmDisplay*
+RefDisplayHandle(EGLDisplay dpy)
+{
+    GbmObject* obj = eGbmRefHandle(dpy);
+
+    if (obj && obj->type != EGL_OBJECT_DISPLAY_KHR) {
+        eGbmUnrefObject(obj);
+        return NULL;
+    }
+
+    return (GbmDisplay*)obj;
+}
+
+EGBM_EXPORT int
+egl_gbm_display_get_memory_info(EGLDisplay dpy,
+                                struct egl_gbm_memory_info* info)
+{
+    GbmDisplay* display;
+
+    if (!info || !(display = RefDisplayHandle(dpy))) return -EINVAL;
+
+    eGbmReadMemoryCounters(&display->memory, info);
+    info->num_surfaces = __atomic_load_n(&display->objects.count,
+                                         __ATOMIC_RELAXED);
+
+    eGbmUnrefObject(&display->base);
+
+    return 0;
+}
+
+EGBM_EXPORT int
+egl_gbm_display_dump(EGLDisplay dpy, int fd)
+{
+    GbmDisplay* display = RefDisplayHandle(dpy);
+    struct egl_gbm_memory_info info;
+
+    if (!display) return -EINVAL;
+
+    eGbmReadMemoryCounters(&display->memory, &info);
+
+    dprintf(fd, "egl-gbm display %p: gbm device %p (%s)\n",
+            (void*)display, (void*)display->gbm,
+            display->fd >= 0 ? "default" : "application");
+    dprintf(fd, "  %u window surfaces, %u images (%" PRIu64 " bytes), "
+            "%u imported (%" PRIu64 " bytes)\n",
+            __atomic_load_n(&display->objects.count, __ATOMIC_RELAXED),
+            info.num_images, info.image_bytes,
+            info.num_imported, info.imported_bytes);
+
+    eGbmSurfaceDumpAll(display, fd);
+
+    eGbmUnrefObject(&display->base);
+
+    return 0;
+}
@@ -9,6 +9,58 @@
 
 #include "gbm-platform.h"
 #include "gbm-handle.h"
+#include "gbm-utils.h"
+#include "gbm-cache.h"
+#include "egl-gbm-ext.h"
+
+#include <pthread.h>
+
+/*
+ * Number of distinct eglChooseConfig() attribute lists remembered per display,
+ * and the longest canonicalized list, including the EGL_NONE terminator, that
+ * can be stored in the cache. Longer lists bypass the cache.
+ */
+#define GBM_CONFIG_CACHE_SIZE 8
+#define GBM_CONFIG_CACHE_MAX_ATTRIBS 64
+
+typedef struct GbmConfigCacheEntryRec {
+    /* Canonicalized attribute list passed to the driver */
+    EGLint attribs[GBM_CONFIG_CACHE_MAX_ATTRIBS];
+    EGLint nativeVisual;
+    /* All configs matching the above, in driver order */
+    EGLConfig* configs;
+    EGLint numConfigs;
+    bool valid;
+} GbmConfigCacheEntry;
+
+typedef struct GbmConfigFourCCRec {
+    EGLConfig config;
+    uint32_t fourcc;
+} GbmConfigFourCC;
+
+/*
+ * Window surface image memory, see struct egl_gbm_memory_info. Updated with
+ * atomics so it can be queried from any thread.
+ */
+typedef struct GbmMemoryCountersRec {
+    uint32_t numImages;
+    uint32_t numImported;
+    uint64_t imageBytes;
+    uint64_t importedBytes;
+} GbmMemoryCounters;
+
+static inline void
+eGbmReadMemoryCounters(const GbmMemoryCounters* counters,
+                       struct egl_gbm_memory_info* info)
+{
+    info->num_images = __atomic_load_n(&counters->numImages, __ATOMIC_RELAXED);
+    info->image_bytes = __atomic_load_n(&counters->imageBytes,
+                                        __ATOMIC_RELAXED);
+    info->num_imported = __atomic_load_n(&counters->numImported,
+                                         __ATOMIC_RELAXED);
+    info->imported_bytes = __atomic_load_n(&counters->importedBytes,
+                                           __ATOMIC_RELAXED);
+}
 
 typedef struct GbmDisplayRec {
     GbmObject base;
@@ -17,6 +69,55 @@ typedef struct GbmDisplayRec {
     EGLDisplay devDpy;
     struct gbm_device* gbm;
     int fd;
+
+    /* The DRM device behind <gbm>, which scans frames out */
+    dev_t gbmRdev;
+
+    /* Set of GbmEglExtension supported by devDpy, valid once initialized */
+    GbmExtensionSet exts;
+
+    /* Persistent metadata for this device, see gbm-cache.h */
+    GbmDeviceCache cache;
+    bool cacheDirty;
+
+    /*
+     * EGLConfig to fourcc table, sorted by config handle. Only built when the
+     * persistent cache is enabled, and only valid while initialized.
+     */
+    GbmConfigFourCC* configFourCCs;
+    EGLint numConfigFourCCs;
+
+    struct {
+        pthread_mutex_t mutex;
+        GbmConfigCacheEntry entries[GBM_CONFIG_CACHE_SIZE];
+        unsigned int next;
+    } configCache;
+
+    /*
+     * Objects created on the display. Window surfaces are currently the only
+     * kind. eglTerminate destroys them all.
+     */
+    GbmObjectList objects;
+
+    /* Totals over the window surfaces in <objects> */
+    GbmMemoryCounters memory;
+
+    /*
+     * Cached EGLImages, as GbmImage trees keyed by gbm_bo, by dma-buf
+     * attributes and by image. See gbm-image.c.
+     */
+    struct {
+        pthread_mutex_t mutex;
+        void* byBo;
+        void* byKey;
+        void* byImage;
+        /* Unreferenced dma-buf imports, most recently used first */
+        struct GbmImageRec* idleFirst;
+        struct GbmImageRec* idleLast;
+        unsigned int numIdle;
+        /* Total size of the dma-bufs behind the idle imports */
+        uint64_t idleBytes;
+    } images;
 } GbmDisplay;
 
 EGLDisplay eGbmGetPlatformDisplayExport(void *data,
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Keep names in ascending order */
+DO_EGL_EXT(EGL_ANDROID_native_fence_sync)
+DO_EGL_EXT(EGL_EXT_device_base)
+DO_EGL_EXT(EGL_EXT_device_drm)
+DO_EGL_EXT(EGL_EXT_device_drm_render_node)
+DO_EGL_EXT(EGL_EXT_device_query)
+DO_EGL_EXT(EGL_EXT_image_dma_buf_import)
+DO_EGL_EXT(EGL_EXT_image_dma_buf_import_modifiers)
+DO_EGL_EXT(EGL_EXT_platform_device)
+DO_EGL_EXT(EGL_EXT_sync_reuse)
+DO_EGL_EXT(EGL_KHR_display_reference)
+DO_EGL_EXT(EGL_KHR_image_base)
+DO_EGL_EXT(EGL_KHR_stream)
+DO_EGL_EXT(EGL_KHR_stream_producer_eglsurface)
+DO_EGL_EXT(EGL_MESA_image_dma_buf_export)
+DO_EGL_EXT(EGL_NV_stream_consumer_eglimage)
+DO_EGL_EXT(EGL_NV_stream_consumer_eglimage_use_scanout_attrib)
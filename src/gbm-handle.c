@@ -6,6 +6,7 @@
 
 #include "gbm-handle.h"
 #include "gbm-mutex.h"
+#include "gbm-stats.h"
 
 #include <stddef.h>
 #include <search.h>
@@ -20,10 +21,17 @@ HandleCompar(const void *a, const void *b)
     if (objA->type != objB->type)
         return objA->type - objB->type;
 
+    /*
+     * Order by address. Subtracting pointers to unrelated objects is
+     * undefined, and the difference doesn't fit an int anyway.
+     */
     if (objA->dpy != objB->dpy)
-        return (const uint8_t *)objA->dpy - (const uint8_t *)objB->dpy;
+        return (uintptr_t)objA->dpy < (uintptr_t)objB->dpy ? -1 : 1;
 
-    return objA - objB;
+    if (objA != objB)
+        return (uintptr_t)objA < (uintptr_t)objB ? -1 : 1;
+
+    return 0;
 }
 
 void *handleTreeRoot = NULL;
@@ -42,6 +50,7 @@ eGbmAddObject(GbmObject* obj)
         goto fail;
 
     res = tsearch(obj, &handleTreeRoot, HandleCompar);
+    if (res) EGBM_STAT_ADD(handles, 1);
 
 fail:
     eGbmHandlesUnlock();
@@ -78,6 +87,8 @@ UnrefObjectLocked(GbmObject* obj)
     if (--obj->refCount == 0) {
         if (!tdelete(obj, &handleTreeRoot, HandleCompar))
             assert(!"Failed to find handle in tree for deletion");
+        else
+            EGBM_STAT_ADD(handles, -1);
 
         eGbmHandlesUnlock();
         obj->free(obj);
@@ -122,3 +133,88 @@ eGbmDestroyHandle(GbmHandle handle)
     UnrefObjectLocked(*res);
     return true;
 }
+
+static void
+UnlinkObject(GbmObjectList* list, GbmObject* obj)
+{
+    if (obj->listPrev)
+        obj->listPrev->listNext = obj->listNext;
+    else
+        list->first = obj->listNext;
+
+    if (obj->listNext) obj->listNext->listPrev = obj->listPrev;
+
+    __atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+    obj->listed = false;
+}
+
+void
+eGbmObjectListAdd(GbmObjectList* list, GbmObject* obj)
+{
+    pthread_mutex_lock(&list->mutex);
+
+    obj->listPrev = NULL;
+    obj->listNext = list->first;
+    if (obj->listNext) obj->listNext->listPrev = obj;
+    list->first = obj;
+    __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED);
+    obj->listed = true;
+
+    pthread_mutex_unlock(&list->mutex);
+}
+
+void
+eGbmObjectListRemove(GbmObjectList* list, GbmObject* obj)
+{
+    pthread_mutex_lock(&list->mutex);
+
+    if (obj->listed) UnlinkObject(list, obj);
+
+    pthread_mutex_unlock(&list->mutex);
+}
+
+void
+eGbmDestroyListHandles(GbmObjectList* list)
+{
+    GbmObject* dead = NULL;
+    GbmObject* obj;
+    GbmObject* next;
+
+    pthread_mutex_lock(&list->mutex);
+
+    if (!eGbmHandlesLock()) {
+        assert(!"Failed to lock handle list to destroy objects");
+        pthread_mutex_unlock(&list->mutex);
+        return;
+    }
+
+    for (obj = list->first; obj; obj = next) {
+        next = obj->listNext;
+
+        if (obj->destroyed) continue;
+
+        obj->destroyed = true;
+
+        assert(obj->refCount >= 1);
+
+        if (--obj->refCount == 0) {
+            if (!tdelete(obj, &handleTreeRoot, HandleCompar))
+                assert(!"Failed to find handle in tree for deletion");
+            else
+                EGBM_STAT_ADD(handles, -1);
+
+            /* Collect the object so it can be freed without the locks */
+            UnlinkObject(list, obj);
+            obj->listNext = dead;
+            dead = obj;
+        }
+    }
+
+    eGbmHandlesUnlock();
+    pthread_mutex_unlock(&list->mutex);
+
+    for (obj = dead; obj; obj = next) {
+        next = obj->listNext;
+        obj->free(obj);
+    }
+}
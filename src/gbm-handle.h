@@ -9,6 +9,8 @@
 
 #include <EGL/egl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
 typedef struct GbmObjectRec {
     void (*free)(struct GbmObjectRec *obj);
@@ -16,8 +18,27 @@ typedef struct GbmObjectRec {
     EGLenum type;
     int refCount;
     bool destroyed;
+
+    /* Membership in a GbmObjectList, protected by the list's mutex */
+    bool listed;
+    struct GbmObjectRec* listPrev;
+    struct GbmObjectRec* listNext;
 } GbmObject;
 
+/*
+ * An intrusive list of objects, used by a display to track the objects
+ * created on it. The list doesn't hold references: objects must remove
+ * themselves from it before they are freed.
+ *
+ * Lock order: the list's mutex may be held while taking the handles lock,
+ * never the other way around.
+ */
+typedef struct GbmObjectListRec {
+    pthread_mutex_t mutex;
+    GbmObject* first;
+    uint32_t count;
+} GbmObjectList;
+
 typedef const GbmObject* GbmHandle;
 
 GbmHandle eGbmAddObject(GbmObject* obj);
@@ -25,4 +46,15 @@ GbmObject* eGbmRefHandle(GbmHandle handle);
 void eGbmUnrefObject(GbmObject* obj);
 bool eGbmDestroyHandle(GbmHandle handle);
 
+void eGbmObjectListAdd(GbmObjectList* list, GbmObject* obj);
+/* Does nothing if <obj> is not in <list> */
+void eGbmObjectListRemove(GbmObjectList* list, GbmObject* obj);
+
+/*
+ * Destroys the handle of every object in <list>, as eGbmDestroyHandle()
+ * would, under a single acquisition of the handles lock. Objects whose last
+ * reference this drops are freed after the locks are released.
+ */
+void eGbmDestroyListHandles(GbmObjectList* list);
+
 #endif /* GBM_HANDLE_H */
@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-image.h"
+#include "gbm-display.h"
+#include "gbm-utils.h"
+#include "gbm-trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <search.h>
+#include <gbm.h>
+#include <drm_fourcc.h>
+
+/*
+ * A cached EGLImage.
+ *
+ * With data->boImageCache, images of gbm_bos passed as EGL_NATIVE_PIXMAP_KHR
+ * are cached in the bo's user data when it is free: the image lives as long
+ * as the bo, and every eglCreateImage call on the bo returns it again.
+ * eglDestroyImage only drops the reference taken by the matching create, and
+ * once the bo is destroyed, the image goes away with its last reference.
+ * Otherwise, or when the user data is taken, the bo is imported into an
+ * uncached image owned by the caller.
+ *
+ * EGL_LINUX_DMA_BUF_EXT imports are cached by their attributes, with each
+ * plane fd replaced by the identity of its dma-buf, see BuildDmaBufKey().
+ * Clients tend to cycle through the same few buffers, so an import whose
+ * last reference is dropped is kept on an idle list, and a later import of
+ * the same buffer with the same layout returns it again. Idle imports keep
+ * their dma-bufs alive, so the least recently used are destroyed beyond
+ * data->dmaBufCacheSize imports or data->dmaBufCacheBytes of dma-buf memory,
+ * and those idle for longer than data->dmaBufCacheAgeNs are destroyed on the
+ * display's next image call.
+ *
+ * Cached images are tracked per display by bo or attributes, and by EGLImage.
+ * The trees and the fields below are protected by display->images.mutex.
+ */
+typedef struct GbmImageRec {
+    GbmDisplay* display;
+    /* EGL_NO_IMAGE_KHR after eglTerminate, until the bo is imported again */
+    EGLImage image;
+    /* eglCreateImage calls not yet matched by eglDestroyImage */
+    unsigned int refCount;
+
+    /* Images of gbm_bos: NULL once the bo has been destroyed */
+    struct gbm_bo* bo;
+
+    /* dma-buf imports: NULL for images of gbm_bos */
+    uint64_t* key;
+    unsigned int keyLen;
+    /* Total size of the dma-bufs the import holds */
+    uint64_t bytes;
+    /* Links in display->images' idle list, while refCount is 0 */
+    struct GbmImageRec* idlePrev;
+    struct GbmImageRec* idleNext;
+    /* When refCount last dropped to 0 */
+    uint64_t idleSince;
+} GbmImage;
+
+/* Longest dma-buf key, in uint64_ts. Longer attribute lists aren't cached */
+#define GBM_DMA_BUF_KEY_MAX 128
+
+static const EGLint PlaneAttribs[GBM_MAX_PLANES][5] = {
+    {
+        EGL_DMA_BUF_PLANE0_FD_EXT,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT,
+        EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+    },
+    {
+        EGL_DMA_BUF_PLANE1_FD_EXT,
+        EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE1_PITCH_EXT,
+        EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+    },
+    {
+        EGL_DMA_BUF_PLANE2_FD_EXT,
+        EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE2_PITCH_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+    },
+    {
+        EGL_DMA_BUF_PLANE3_FD_EXT,
+        EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE3_PITCH_EXT,
+        EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT,
+    },
+};
+
+static int
+ComparePointers(const void* a, const void* b)
+{
+    uintptr_t ptrA = (uintptr_t)a;
+    uintptr_t ptrB = (uintptr_t)b;
+
+    return ptrA < ptrB ? -1 : ptrA > ptrB;
+}
+
+static int
+CompareBo(const void* a, const void* b)
+{
+    return ComparePointers(((const GbmImage*)a)->bo,
+                           ((const GbmImage*)b)->bo);
+}
+
+static int
+CompareKey(const void* a, const void* b)
+{
+    const GbmImage* entryA = a;
+    const GbmImage* entryB = b;
+
+    if (entryA->keyLen != entryB->keyLen)
+        return entryA->keyLen < entryB->keyLen ? -1 : 1;
+
+    return memcmp(entryA->key, entryB->key,
+                  entryA->keyLen * sizeof(entryA->key[0]));
+}
+
+static int
+CompareImage(const void* a, const void* b)
+{
+    return ComparePointers(((const GbmImage*)a)->image,
+                           ((const GbmImage*)b)->image);
+}
+
+/* Imports the planes of <bo> as an EGL_LINUX_DMA_BUF_EXT image */
+static EGLImage
+ImportBo(GbmDisplay* display, struct gbm_bo* bo, EGLint* err)
+{
+    GbmPlatformData* data = display->data;
+    EGLint attribs[6 + GBM_MAX_PLANES * 10 + 3];
+    int fds[GBM_MAX_PLANES];
+    uint64_t modifier = gbm_bo_get_modifier(bo);
+    int planes = gbm_bo_get_plane_count(bo);
+    bool useModifier =
+        modifier != DRM_FORMAT_MOD_INVALID &&
+        eGbmHasExtension(display->exts,
+                         GBM_EGL_EXT_image_dma_buf_import_modifiers);
+    EGLImage image = EGL_NO_IMAGE_KHR;
+    int numFds = 0;
+    int n = 0;
+    int i;
+
+    if (planes < 1 || planes > GBM_MAX_PLANES) {
+        *err = EGL_BAD_PARAMETER;
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = gbm_bo_get_width(bo);
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = gbm_bo_get_height(bo);
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = gbm_bo_get_format(bo);
+
+    for (i = 0; i < planes; i++) {
+        fds[i] = gbm_bo_get_fd_for_plane(bo, i);
+
+        if (fds[i] < 0) {
+            *err = EGL_BAD_ALLOC;
+            goto done;
+        }
+
+        numFds++;
+
+        attribs[n++] = PlaneAttribs[i][0];
+        attribs[n++] = fds[i];
+        attribs[n++] = PlaneAttribs[i][1];
+        attribs[n++] = gbm_bo_get_offset(bo, i);
+        attribs[n++] = PlaneAttribs[i][2];
+        attribs[n++] = gbm_bo_get_stride_for_plane(bo, i);
+
+        if (useModifier) {
+            attribs[n++] = PlaneAttribs[i][3];
+            attribs[n++] = (EGLint)(modifier & 0xffffffff);
+            attribs[n++] = PlaneAttribs[i][4];
+            attribs[n++] = (EGLint)(modifier >> 32);
+        }
+    }
+
+    attribs[n++] = EGL_IMAGE_PRESERVED_KHR;
+    attribs[n++] = EGL_TRUE;
+    attribs[n] = EGL_NONE;
+
+    image = data->egl.CreateImageKHR(display->devDpy,
+                                     EGL_NO_CONTEXT,
+                                     EGL_LINUX_DMA_BUF_EXT,
+                                     NULL,
+                                     attribs);
+
+    if (image == EGL_NO_IMAGE_KHR) *err = data->egl.GetError();
+
+done:
+    /* The image holds its own references to the buffer */
+    for (i = 0; i < numFds; i++) close(fds[i]);
+
+    return image;
+}
+
+static void
+FreeImage(GbmImage* entry)
+{
+    eGbmUnrefObject(&entry->display->base);
+    free(entry->key);
+    free(entry);
+}
+
+/*
+ * Destroys the image of <entry> once both the bo and every reference handed
+ * out are gone. Returns true if the caller must free <entry>, which it does
+ * after dropping display->images.mutex.
+ */
+static bool
+ReleaseIfUnused(GbmImage* entry)
+{
+    GbmDisplay* display = entry->display;
+
+    if (entry->bo || entry->refCount) return false;
+
+    if (entry->image != EGL_NO_IMAGE_KHR) {
+        tdelete(entry, &display->images.byImage, CompareImage);
+        display->data->egl.DestroyImageKHR(display->devDpy, entry->image);
+    }
+
+    return true;
+}
+
+/* The bo's destroy_user_data callback */
+static void
+BoImageDestroyed(struct gbm_bo* bo, void* userData)
+{
+    GbmImage* entry = userData;
+    GbmDisplay* display = entry->display;
+    bool unused;
+
+    (void)bo;
+
+    pthread_mutex_lock(&display->images.mutex);
+
+    tdelete(entry, &display->images.byBo, CompareBo);
+    entry->bo = NULL;
+    unused = ReleaseIfUnused(entry);
+
+    pthread_mutex_unlock(&display->images.mutex);
+
+    if (unused) FreeImage(entry);
+}
+
+/* Adds a new cache entry for <bo>. Called with display->images.mutex held */
+static EGLImage
+CacheBoImage(GbmDisplay* display, struct gbm_bo* bo, EGLint* err)
+{
+    GbmImage* entry = calloc(1, sizeof(*entry));
+
+    if (!entry) {
+        *err = EGL_BAD_ALLOC;
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    entry->bo = bo;
+    entry->image = ImportBo(display, bo, err);
+
+    if (entry->image == EGL_NO_IMAGE_KHR) goto fail;
+
+    if (!tsearch(entry, &display->images.byBo, CompareBo)) {
+        *err = EGL_BAD_ALLOC;
+        goto fail;
+    }
+
+    if (!tsearch(entry, &display->images.byImage, CompareImage)) {
+        tdelete(entry, &display->images.byBo, CompareBo);
+        *err = EGL_BAD_ALLOC;
+        goto fail;
+    }
+
+    /* The entry keeps the display alive for BoImageDestroyed() */
+    entry->display = (GbmDisplay*)eGbmRefHandle(&display->base);
+    entry->refCount = 1;
+    gbm_bo_set_user_data(bo, entry, BoImageDestroyed);
+
+    return entry->image;
+
+fail:
+    if (entry->image != EGL_NO_IMAGE_KHR)
+        display->data->egl.DestroyImageKHR(display->devDpy, entry->image);
+    free(entry);
+
+    return EGL_NO_IMAGE_KHR;
+}
+
+static EGLImage
+CreateBoImage(GbmDisplay* display,
+              EGLContext ctx,
+              struct gbm_bo* bo,
+              EGLint* err)
+{
+    GbmImage key = { .bo = bo };
+    GbmImage** found;
+    GbmImage* entry = NULL;
+    GbmImage* stale = NULL;
+    EGLImage image = EGL_NO_IMAGE_KHR;
+    bool hit = false;
+
+    /* From EGL_KHR_image_pixmap */
+    if (ctx != EGL_NO_CONTEXT) {
+        *err = EGL_BAD_PARAMETER;
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    if (!eGbmHasExtension(display->exts, GBM_EGL_EXT_image_dma_buf_import) ||
+        !bo || !eGbmPointerIsDereferenceable(bo) ||
+        gbm_bo_get_device(bo) != display->gbm) {
+        *err = EGL_BAD_PARAMETER;
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    pthread_mutex_lock(&display->images.mutex);
+
+    found = tfind(&key, &display->images.byBo, CompareBo);
+
+    if (found) {
+        entry = *found;
+
+        if (gbm_bo_get_user_data(bo) != entry) {
+            /*
+             * The application replaced the user data, so the entry won't
+             * hear about this bo's destruction. Forget about the bo.
+             */
+            tdelete(entry, &display->images.byBo, CompareBo);
+            entry->bo = NULL;
+            if (ReleaseIfUnused(entry)) stale = entry;
+            entry = NULL;
+        }
+    }
+
+    if (entry) {
+        if (entry->image == EGL_NO_IMAGE_KHR) {
+            /* Imported again after eglTerminate */
+            entry->image = ImportBo(display, bo, err);
+
+            if (entry->image == EGL_NO_IMAGE_KHR) goto done;
+
+            if (!tsearch(entry, &display->images.byImage, CompareImage)) {
+                display->data->egl.DestroyImageKHR(display->devDpy,
+                                                   entry->image);
+                entry->image = EGL_NO_IMAGE_KHR;
+                *err = EGL_BAD_ALLOC;
+                goto done;
+            }
+        } else {
+            hit = true;
+        }
+
+        entry->refCount++;
+        image = entry->image;
+    } else if (display->data->boImageCache && !gbm_bo_get_user_data(bo)) {
+        image = CacheBoImage(display, bo, err);
+    } else {
+        image = ImportBo(display, bo, err);
+    }
+
+done:
+    pthread_mutex_unlock(&display->images.mutex);
+
+    if (stale) FreeImage(stale);
+
+    EGBM_TRACE3(bo_image, bo, image, hit);
+
+    return image;
+}
+
+static bool
+IsPlaneFdAttrib(EGLint name)
+{
+    int i;
+
+    for (i = 0; i < GBM_MAX_PLANES; i++) {
+        if (name == PlaneAttribs[i][0]) return true;
+    }
+
+    return false;
+}
+
+/*
+ * Builds the cache key of an EGL_LINUX_DMA_BUF_EXT attribute list: the list
+ * itself, with each plane fd replaced by the device and inode of its dma-buf.
+ * Every import of a dma-buf has the same identity, and the driver's image
+ * keeps the dma-buf, hence its inode number, alive while cached.
+ *
+ * Returns the length of the key, or 0 if the list can't be cached. <bytes>
+ * is set to the total size of the distinct dma-bufs, which the kernel
+ * reports as their file size.
+ */
+static unsigned int
+BuildDmaBufKey(const EGLint* attribs, uint64_t* key, uint64_t* bytes)
+{
+    struct stat st;
+    ino_t inos[GBM_MAX_PLANES];
+    unsigned int numInos = 0;
+    unsigned int n = 0;
+    unsigned int i, j;
+
+    if (!attribs) return 0;
+
+    *bytes = 0;
+
+    for (i = 0; attribs[i] != EGL_NONE; i += 2) {
+        if (n + 3 > GBM_DMA_BUF_KEY_MAX) return 0;
+
+        key[n++] = (uint32_t)attribs[i];
+
+        if (IsPlaneFdAttrib(attribs[i])) {
+            if (fstat(attribs[i + 1], &st)) return 0;
+
+            key[n++] = st.st_dev;
+            key[n++] = st.st_ino;
+
+            /* Planes often share one dma-buf */
+            for (j = 0; j < numInos; j++) {
+                if (inos[j] == st.st_ino) break;
+            }
+
+            if (j == numInos && numInos < GBM_MAX_PLANES) {
+                inos[numInos++] = st.st_ino;
+                *bytes += st.st_size;
+            }
+        } else {
+            key[n++] = (uint32_t)attribs[i + 1];
+        }
+    }
+
+    return n;
+}
+
+/* Called with display->images.mutex held */
+static void
+AddIdle(GbmDisplay* display, GbmImage* entry)
+{
+    entry->idlePrev = NULL;
+    entry->idleNext = display->images.idleFirst;
+
+    if (entry->idleNext)
+        entry->idleNext->idlePrev = entry;
+    else
+        display->images.idleLast = entry;
+
+    display->images.idleFirst = entry;
+    display->images.numIdle++;
+    display->images.idleBytes += entry->bytes;
+    entry->idleSince = eGbmTraceNow();
+}
+
+/* Called with display->images.mutex held */
+static void
+RemoveIdle(GbmDisplay* display, GbmImage* entry)
+{
+    if (entry->idlePrev)
+        entry->idlePrev->idleNext = entry->idleNext;
+    else
+        display->images.idleFirst = entry->idleNext;
+
+    if (entry->idleNext)
+        entry->idleNext->idlePrev = entry->idlePrev;
+    else
+        display->images.idleLast = entry->idlePrev;
+
+    entry->idlePrev = entry->idleNext = NULL;
+    display->images.numIdle--;
+    display->images.idleBytes -= entry->bytes;
+}
+
+/* Returns true if the least recently used idle import must be destroyed */
+static bool
+MustEvict(GbmDisplay* display, uint64_t now)
+{
+    GbmPlatformData* data = display->data;
+    GbmImage* entry = display->images.idleLast;
+
+    if (!entry) return false;
+
+    return display->images.numIdle > data->dmaBufCacheSize ||
+           display->images.idleBytes > data->dmaBufCacheBytes ||
+           (data->dmaBufCacheAgeNs &&
+            now - entry->idleSince > data->dmaBufCacheAgeNs);
+}
+
+/*
+ * Destroys the least recently used idle dma-buf imports until the rest fit
+ * the cache limits. Called with display->images.mutex held. Returns the
+ * evicted entries, linked through idleNext, for the caller to free with
+ * FreeImageList() after dropping the mutex.
+ */
+static GbmImage*
+EvictIdle(GbmDisplay* display)
+{
+    GbmImage* evicted = NULL;
+    GbmImage* entry;
+    uint64_t now = display->images.idleLast ? eGbmTraceNow() : 0;
+
+    while (MustEvict(display, now)) {
+        entry = display->images.idleLast;
+
+        RemoveIdle(display, entry);
+        tdelete(entry, &display->images.byKey, CompareKey);
+        tdelete(entry, &display->images.byImage, CompareImage);
+        display->data->egl.DestroyImageKHR(display->devDpy, entry->image);
+
+        entry->idleNext = evicted;
+        evicted = entry;
+    }
+
+    return evicted;
+}
+
+static void
+FreeImageList(GbmImage* entry)
+{
+    GbmImage* next;
+
+    for (; entry; entry = next) {
+        next = entry->idleNext;
+        FreeImage(entry);
+    }
+}
+
+/*
+ * Adds a cache entry for the dma-buf import <image> under the key of
+ * <lookup>. Called with display->images.mutex held. If this fails, the image
+ * is simply left uncached.
+ */
+static void
+CacheDmaBufImage(GbmDisplay* display, EGLImage image, const GbmImage* lookup)
+{
+    GbmImage* entry = calloc(1, sizeof(*entry));
+
+    if (!entry) return;
+
+    entry->key = malloc(lookup->keyLen * sizeof(entry->key[0]));
+
+    if (!entry->key) goto fail;
+
+    memcpy(entry->key, lookup->key, lookup->keyLen * sizeof(entry->key[0]));
+    entry->keyLen = lookup->keyLen;
+    entry->bytes = lookup->bytes;
+    entry->image = image;
+
+    if (!tsearch(entry, &display->images.byKey, CompareKey)) goto fail;
+
+    if (!tsearch(entry, &display->images.byImage, CompareImage)) {
+        tdelete(entry, &display->images.byKey, CompareKey);
+        goto fail;
+    }
+
+    entry->display = (GbmDisplay*)eGbmRefHandle(&display->base);
+    entry->refCount = 1;
+
+    return;
+
+fail:
+    free(entry->key);
+    free(entry);
+}
+
+static EGLImage
+CreateDmaBufImage(GbmDisplay* display,
+                  EGLContext ctx,
+                  EGLClientBuffer buffer,
+                  const EGLint* attribs)
+{
+    GbmPlatformData* data = display->data;
+    uint64_t key[GBM_DMA_BUF_KEY_MAX];
+    GbmImage lookup = { .key = key };
+    GbmImage** found;
+    GbmImage* entry;
+    GbmImage* evicted;
+    EGLImage image;
+    unsigned int numIdle;
+    bool hit = false;
+
+    /* Invalid arguments are left for the driver to report */
+    if (data->dmaBufCacheSize && ctx == EGL_NO_CONTEXT && !buffer)
+        lookup.keyLen = BuildDmaBufKey(attribs, key, &lookup.bytes);
+
+    if (!lookup.keyLen) {
+        return data->egl.CreateImageKHR(display->devDpy, ctx,
+                                        EGL_LINUX_DMA_BUF_EXT, buffer,
+                                        attribs);
+    }
+
+    pthread_mutex_lock(&display->images.mutex);
+
+    found = tfind(&lookup, &display->images.byKey, CompareKey);
+
+    if (found) {
+        entry = *found;
+        if (!entry->refCount++) RemoveIdle(display, entry);
+        image = entry->image;
+        hit = true;
+    } else {
+        image = data->egl.CreateImageKHR(display->devDpy, ctx,
+                                         EGL_LINUX_DMA_BUF_EXT, buffer,
+                                         attribs);
+
+        if (image != EGL_NO_IMAGE_KHR)
+            CacheDmaBufImage(display, image, &lookup);
+    }
+
+    /* Imports the client stopped using age out */
+    evicted = EvictIdle(display);
+    numIdle = display->images.numIdle;
+
+    pthread_mutex_unlock(&display->images.mutex);
+
+    FreeImageList(evicted);
+
+    EGBM_TRACE3(dma_buf_image, image, hit, numIdle);
+
+    return image;
+}
+
+static bool
+IsPixmapAttrib(EGLAttrib name)
+{
+    /* Images of gbm_bos are always preserved */
+    return name == EGL_IMAGE_PRESERVED_KHR;
+}
+
+EGLImageKHR
+eGbmCreateImageKHRHook(EGLDisplay dpy,
+                       EGLContext ctx,
+                       EGLenum target,
+                       EGLClientBuffer buffer,
+                       const EGLint* attribs)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    EGLImageKHR image = EGL_NO_IMAGE_KHR;
+    EGLint err = EGL_SUCCESS;
+    unsigned int i;
+
+    if (!display) {
+        /*  No platform data. Can't set error EGL_NO_DISPLAY */
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    if (target == EGL_LINUX_DMA_BUF_EXT) {
+        image = CreateDmaBufImage(display, ctx, buffer, attribs);
+        goto done;
+    }
+
+    if (target != EGL_NATIVE_PIXMAP_KHR) {
+        image = display->data->egl.CreateImageKHR(display->devDpy, ctx,
+                                                  target, buffer, attribs);
+        goto done;
+    }
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (!IsPixmapAttrib(attribs[i])) {
+            err = EGL_BAD_PARAMETER;
+            goto done;
+        }
+    }
+
+    image = CreateBoImage(display, ctx, buffer, &err);
+
+done:
+    if (err != EGL_SUCCESS) eGbmSetError(display->data, err);
+
+    eGbmUnrefObject(&display->base);
+
+    return image;
+}
+
+/*
+ * Converts an EGLAttrib list to the EGLint form eglCreateImageKHR takes.
+ * Returns false if it doesn't fit in the <size> entries of <out>.
+ */
+static bool
+ToIntAttribs(const EGLAttrib* attribs, EGLint* out, unsigned int size)
+{
+    unsigned int i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (i + 3 > size) return false;
+
+        out[i] = (EGLint)attribs[i];
+        out[i + 1] = (EGLint)attribs[i + 1];
+    }
+
+    out[i] = EGL_NONE;
+
+    return true;
+}
+
+EGLImage
+eGbmCreateImageHook(EGLDisplay dpy,
+                    EGLContext ctx,
+                    EGLenum target,
+                    EGLClientBuffer buffer,
+                    const EGLAttrib* attribs)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    EGLint intAttribs[GBM_DMA_BUF_KEY_MAX];
+    EGLImage image = EGL_NO_IMAGE;
+    EGLint err = EGL_SUCCESS;
+    unsigned int i;
+
+    if (!display) {
+        /*  No platform data. Can't set error EGL_NO_DISPLAY */
+        return EGL_NO_IMAGE;
+    }
+
+    if (target == EGL_LINUX_DMA_BUF_EXT &&
+        ToIntAttribs(attribs, intAttribs, GBM_DMA_BUF_KEY_MAX)) {
+        image = CreateDmaBufImage(display, ctx, buffer, intAttribs);
+        goto done;
+    }
+
+    if (target != EGL_NATIVE_PIXMAP_KHR) {
+        image = display->data->egl.CreateImage(display->devDpy, ctx,
+                                               target, buffer, attribs);
+        goto done;
+    }
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (!IsPixmapAttrib(attribs[i])) {
+            err = EGL_BAD_PARAMETER;
+            goto done;
+        }
+    }
+
+    image = CreateBoImage(display, ctx, buffer, &err);
+
+done:
+    if (err != EGL_SUCCESS) eGbmSetError(display->data, err);
+
+    eGbmUnrefObject(&display->base);
+
+    return image;
+}
+
+EGLBoolean
+eGbmDestroyImageHook(EGLDisplay dpy, EGLImage image)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    GbmImage key = { .image = image };
+    GbmImage** found;
+    GbmImage* entry = NULL;
+    GbmImage* unused = NULL;
+    GbmImage* evicted = NULL;
+    EGLBoolean ret = EGL_TRUE;
+
+    if (!display) {
+        /*  No platform data. Can't set error EGL_NO_DISPLAY */
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&display->images.mutex);
+
+    found = image != EGL_NO_IMAGE_KHR ?
+        tfind(&key, &display->images.byImage, CompareImage) : NULL;
+    if (found) entry = *found;
+
+    if (entry && entry->refCount) {
+        entry->refCount--;
+
+        if (!entry->key) {
+            if (ReleaseIfUnused(entry)) unused = entry;
+        } else if (!entry->refCount) {
+            /* Keep the import around for the client's next frames */
+            AddIdle(display, entry);
+            evicted = EvictIdle(display);
+        }
+    } else if (entry) {
+        /* Destroyed more often than it was created */
+        eGbmSetError(display->data, EGL_BAD_PARAMETER);
+        ret = EGL_FALSE;
+    }
+
+    pthread_mutex_unlock(&display->images.mutex);
+
+    if (!entry)
+        ret = display->data->egl.DestroyImageKHR(display->devDpy, image);
+
+    if (unused) FreeImage(unused);
+    FreeImageList(evicted);
+
+    eGbmUnrefObject(&display->base);
+
+    return ret;
+}
+
+/* tdestroy() callbacks for eGbmImagesTerminate() */
+static void
+KeepNode(void* node)
+{
+    (void)node;
+}
+
+static void
+TerminateImage(void* node)
+{
+    GbmImage* entry = node;
+    GbmDisplay* display = entry->display;
+
+    display->data->egl.DestroyImageKHR(display->devDpy, entry->image);
+    entry->image = EGL_NO_IMAGE_KHR;
+    entry->refCount = 0;
+
+    /* Entries still attached to a bo wait for it in the byBo tree */
+    if (!entry->bo) FreeImage(entry);
+}
+
+void
+eGbmImagesTerminate(GbmDisplay* display)
+{
+    pthread_mutex_lock(&display->images.mutex);
+
+    /* dma-buf imports are all freed through the byImage tree */
+    tdestroy(display->images.byKey, KeepNode);
+    display->images.byKey = NULL;
+    display->images.idleFirst = display->images.idleLast = NULL;
+    display->images.numIdle = 0;
+    display->images.idleBytes = 0;
+
+    tdestroy(display->images.byImage, TerminateImage);
+    display->images.byImage = NULL;
+
+    pthread_mutex_unlock(&display->images.mutex);
+}
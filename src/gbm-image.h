@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_IMAGE_H
+#define GBM_IMAGE_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+struct GbmDisplayRec;
+
+EGLImageKHR eGbmCreateImageKHRHook(EGLDisplay dpy,
+                                   EGLContext ctx,
+                                   EGLenum target,
+                                   EGLClientBuffer buffer,
+                                   const EGLint* attribs);
+EGLImage eGbmCreateImageHook(EGLDisplay dpy,
+                             EGLContext ctx,
+                             EGLenum target,
+                             EGLClientBuffer buffer,
+                             const EGLAttrib* attribs);
+/* Serves both eglDestroyImage and eglDestroyImageKHR */
+EGLBoolean eGbmDestroyImageHook(EGLDisplay dpy, EGLImage image);
+
+/* Releases every EGLImage cached on <display> */
+void eGbmImagesTerminate(struct GbmDisplayRec* display);
+
+#endif /* GBM_IMAGE_H */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-modifier.h"
+
+#include <string.h>
+#include <drm_fourcc.h>
+
+/* Fields of DRM_FORMAT_MOD_NVIDIA_BLOCK_LINEAR_2D() */
+#define NVIDIA_BLOCK_LINEAR 0x10
+#define NVIDIA_COMPRESSION_SHIFT 23
+#define NVIDIA_COMPRESSION_MASK 0x7
+
+static int
+RankModifier(uint64_t modifier)
+{
+    if (modifier == DRM_FORMAT_MOD_LINEAR) return 0;
+
+    if ((modifier >> 56) == DRM_FORMAT_MOD_VENDOR_NVIDIA &&
+        (modifier & NVIDIA_BLOCK_LINEAR)) {
+        /* The compression type is 0 for uncompressed surfaces */
+        if ((modifier >> NVIDIA_COMPRESSION_SHIFT) & NVIDIA_COMPRESSION_MASK)
+            return 3;
+
+        return 2;
+    }
+
+    /* Some other vendor's tiling, likely still better than linear */
+    return 1;
+}
+
+static bool
+KeyEqual(const GbmScanoutKey* a, const GbmScanoutKey* b)
+{
+    return a->dev == b->dev &&
+           a->format == b->format &&
+           a->width == b->width &&
+           a->height == b->height;
+}
+
+/* Called with the cache locked */
+static GbmScanoutResult*
+FindResult(GbmScanoutCache* cache, const GbmScanoutKey* key, uint64_t modifier)
+{
+    unsigned int i;
+
+    for (i = 0; i < GBM_SCANOUT_CACHE_SIZE; i++) {
+        GbmScanoutResult* entry = &cache->entries[i];
+
+        if (entry->valid &&
+            entry->modifier == modifier &&
+            KeyEqual(&entry->key, key))
+            return entry;
+    }
+
+    return NULL;
+}
+
+void
+eGbmScanoutCacheInit(GbmScanoutCache* cache)
+{
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->next = 0;
+    pthread_mutex_init(&cache->mutex, NULL);
+}
+
+void
+eGbmScanoutCacheFini(GbmScanoutCache* cache)
+{
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+void
+eGbmScanoutCacheReport(GbmScanoutCache* cache,
+                       const GbmScanoutKey* key,
+                       uint64_t modifier,
+                       bool accepted)
+{
+    GbmScanoutResult* entry;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    entry = FindResult(cache, key, modifier);
+
+    if (!entry) {
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % GBM_SCANOUT_CACHE_SIZE;
+
+        entry->key = *key;
+        entry->modifier = modifier;
+        entry->valid = true;
+    }
+
+    entry->accepted = accepted;
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+int
+eGbmSelectModifiers(GbmScanoutCache* cache,
+                    const GbmScanoutKey* key,
+                    const uint64_t* offered,
+                    int count,
+                    uint64_t* selected)
+{
+    const GbmScanoutResult* entry;
+    int n = 0;
+    int kept;
+    int rank;
+    int i, j;
+
+    /* Insertion sort, which keeps the application's order within a rank */
+    for (i = 0; i < count; i++) {
+        if (offered[i] == DRM_FORMAT_MOD_INVALID) continue;
+
+        rank = RankModifier(offered[i]);
+
+        for (j = n; j > 0 && RankModifier(selected[j - 1]) < rank; j--)
+            selected[j] = selected[j - 1];
+
+        selected[j] = offered[i];
+        n++;
+    }
+
+    if (!cache || !n) return n;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    for (i = 0; i < n; i++) {
+        entry = FindResult(cache, key, selected[i]);
+
+        if (entry && entry->accepted) {
+            selected[0] = selected[i];
+            n = 1;
+            goto done;
+        }
+    }
+
+    for (i = 0, kept = 0; i < n; i++) {
+        entry = FindResult(cache, key, selected[i]);
+
+        if (!entry) selected[kept++] = selected[i];
+    }
+
+    /* If every modifier was rejected, a composited fallback beats nothing */
+    if (kept) n = kept;
+
+done:
+    pthread_mutex_unlock(&cache->mutex);
+
+    return n;
+}
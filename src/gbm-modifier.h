@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_MODIFIER_H
+#define GBM_MODIFIER_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define GBM_SCANOUT_CACHE_SIZE 64
+
+/*
+ * Picks the modifiers a window surface offers the driver, out of those the
+ * application offered.
+ *
+ * Modifiers are ranked by how little memory bandwidth scanning them out
+ * takes: compressed NVIDIA block-linear first, then uncompressed
+ * block-linear, other tiled layouts, and linear last. For scanout surfaces,
+ * a cache of the modifiers the display engine accepted or rejected, as
+ * reported by the compositor, steers later surfaces of the same device,
+ * format and size to the fastest modifier known to work.
+ */
+typedef struct GbmScanoutKeyRec {
+    /* The DRM device frames are scanned out on */
+    dev_t dev;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+} GbmScanoutKey;
+
+typedef struct GbmScanoutResultRec {
+    GbmScanoutKey key;
+    uint64_t modifier;
+    bool valid;
+    bool accepted;
+} GbmScanoutResult;
+
+typedef struct GbmScanoutCacheRec {
+    pthread_mutex_t mutex;
+    /* Replaced round-robin once full */
+    GbmScanoutResult entries[GBM_SCANOUT_CACHE_SIZE];
+    unsigned int next;
+} GbmScanoutCache;
+
+void eGbmScanoutCacheInit(GbmScanoutCache* cache);
+void eGbmScanoutCacheFini(GbmScanoutCache* cache);
+
+/* Records whether the display engine could scan out <modifier> */
+void eGbmScanoutCacheReport(GbmScanoutCache* cache,
+                            const GbmScanoutKey* key,
+                            uint64_t modifier,
+                            bool accepted);
+
+/*
+ * Writes the <count> modifiers in <offered>, ranked, to <selected>, and
+ * returns how many were written.
+ *
+ * If <cache> is not NULL, modifiers rejected for <key> are left out, unless
+ * all of them were, and if any of the rest is known to be accepted, only the
+ * best such modifier is written.
+ */
+int eGbmSelectModifiers(GbmScanoutCache* cache,
+                        const GbmScanoutKey* key,
+                        const uint64_t* offered,
+                        int count,
+                        uint64_t* selected);
+
+#endif /* GBM_MODIFIER_H */
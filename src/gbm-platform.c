@@ -5,10 +5,16 @@
  */
 
 #include "gbm-utils.h"
+#include "gbm-cache.h"
 #include "gbm-display.h"
 #include "gbm-platform.h"
 #include "gbm-surface.h"
+#include "gbm-image.h"
+#include "gbm-trace.h"
+#include "gbm-stats.h"
 
+#include <gbmint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dlfcn.h>
@@ -16,17 +22,40 @@
 static void
 DestroyPlatformData(GbmPlatformData* data)
 {
+    /*
+     * Deferred teardown may still use the EGL imports. Readbacks go first, as
+     * dropping their surface references may queue teardown.
+     */
+    eGbmWorkerFini(&data->readbackWorker);
+    eGbmWorkerFini(&data->worker);
+    eGbmCacheFini(data);
+    eGbmScanoutCacheFini(&data->scanout);
     free(data);
 }
 
 static GbmPlatformData*
 CreatePlatformData(const EGLExtDriver *driver)
 {
-    const char* clExts;
     GbmPlatformData *res = calloc(1, sizeof(*res));
 
     if (!res) return NULL;
 
+    eGbmWorkerInit(&res->worker);
+    eGbmWorkerInit(&res->readbackWorker);
+    eGbmScanoutCacheInit(&res->scanout);
+    res->asyncDestroy = eGbmGetEnvUint("EGL_GBM_ASYNC_DESTROY", 0) != 0;
+    res->deferAcquireWait =
+        eGbmGetEnvUint("EGL_GBM_DEFER_ACQUIRE_WAIT", 0) != 0;
+    res->dmaBufCacheSize = eGbmGetEnvUint("EGL_GBM_DMA_BUF_CACHE_SIZE", 32);
+    res->dmaBufCacheBytes =
+        eGbmGetEnvUint("EGL_GBM_DMA_BUF_CACHE_MB", 64) << 20;
+    res->dmaBufCacheAgeNs =
+        eGbmGetEnvUint("EGL_GBM_DMA_BUF_CACHE_AGE_MS", 1000) * 1000000ULL;
+    res->boImageCache = eGbmGetEnvUint("EGL_GBM_BO_IMAGE_CACHE", 0) != 0;
+    res->waitTimeoutNs =
+        eGbmGetEnvUint("EGL_GBM_WAIT_TIMEOUT_MS", 0) * 1000000ULL;
+    res->waitFallback = eGbmGetEnvUint("EGL_GBM_WAIT_FALLBACK", 0) != 0;
+
 #if defined(RTLD_DEFAULT)
     res->ptr_gbm_device_get_backend_name = dlsym(RTLD_DEFAULT, "gbm_device_get_backend_name");
     if (res->ptr_gbm_device_get_backend_name == NULL) {
@@ -46,19 +75,22 @@ CreatePlatformData(const EGLExtDriver *driver)
 
     res->driver.setError = driver->setError;
 
-    clExts = res->egl.QueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    res->clientExts =
+        eGbmParseExtensions(res->egl.QueryString(EGL_NO_DISPLAY,
+                                                 EGL_EXTENSIONS));
 
-    if (!eGbmFindExtension("EGL_EXT_platform_device", clExts) ||
-        (!eGbmFindExtension("EGL_EXT_device_query", clExts) &&
-         !eGbmFindExtension("EGL_EXT_device_base", clExts))) {
+    if (!eGbmHasExtension(res->clientExts, GBM_EGL_EXT_platform_device) ||
+        (!eGbmHasExtension(res->clientExts, GBM_EGL_EXT_device_query) &&
+         !eGbmHasExtension(res->clientExts, GBM_EGL_EXT_device_base))) {
         DestroyPlatformData(res);
         return NULL;
     }
 
-    if (eGbmFindExtension("EGL_KHR_display_reference", clExts))
-        res->supportsDisplayReference = true;
-    else
-        res->supportsDisplayReference = false;
+    res->supportsDisplayReference =
+        eGbmHasExtension(res->clientExts, GBM_EGL_KHR_display_reference);
+
+    /* Failure just leaves the persistent cache disabled */
+    eGbmCacheInit(res, driver);
 
     return res;
 }
@@ -110,21 +142,345 @@ CreatePbufferSurfaceHook(EGLDisplay dpy,
     return data->egl.CreatePbufferSurface(display->devDpy, config, attribs);
 }
 
+/* Hooks counted by the stats endpoint. Aliases share an entry */
+typedef enum {
+    HOOK_CHOOSE_CONFIG,
+    HOOK_CREATE_IMAGE,
+    HOOK_CREATE_IMAGE_KHR,
+    HOOK_CREATE_PBUFFER_SURFACE,
+    HOOK_CREATE_PLATFORM_PIXMAP_SURFACE,
+    HOOK_CREATE_PLATFORM_WINDOW_SURFACE,
+    HOOK_DESTROY_IMAGE,
+    HOOK_DESTROY_SURFACE,
+    HOOK_GET_CONFIG_ATTRIB,
+    HOOK_INITIALIZE,
+    HOOK_PRESENTATION_TIME,
+    HOOK_QUERY_DISPLAY_ATTRIB,
+    HOOK_TERMINATE,
+    HOOK_COUNT
+} GbmHookId;
+
+static uint64_t HookCalls[HOOK_COUNT];
+
+/*
+ * The hooks and exports below are wrapped so that each gets a pair of
+ * entry/return tracepoints without disturbing its own control flow. See
+ * gbm-trace-probes.h for the probe arguments.
+ */
+static EGLBoolean
+TraceChooseConfig(EGLDisplay dpy,
+                  EGLint const* attribs,
+                  EGLConfig* configs,
+                  EGLint configSize,
+                  EGLint *numConfig)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CHOOSE_CONFIG], 1);
+
+    if (eGbmRecording) {
+        int64_t args[GBM_RECORD_MAX_ARGS];
+        unsigned int n = 0;
+
+        /* Record the list including its EGL_NONE terminator */
+        while (attribs && n + 1 < ARRAY_LEN(args) && attribs[n] != EGL_NONE) {
+            args[n] = attribs[n];
+            n++;
+        }
+        args[n++] = EGL_NONE;
+
+        eGbmRecordEvent(GBM_RECORD_OP_choose_config_attribs, n, args);
+    }
+
+    EGBM_TRACE1(choose_config_entry, dpy);
+    ret = eGbmChooseConfigHook(dpy, attribs, configs, configSize, numConfig);
+    EGBM_TRACE3(choose_config_return, dpy, ret,
+                (ret && numConfig) ? *numConfig : 0);
+
+    return ret;
+}
+
+static EGLImageKHR
+TraceCreateImageKHR(EGLDisplay dpy,
+                    EGLContext ctx,
+                    EGLenum target,
+                    EGLClientBuffer buffer,
+                    const EGLint* attribs)
+{
+    EGLImageKHR ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CREATE_IMAGE_KHR], 1);
+
+    EGBM_TRACE3(create_image_entry, dpy, target, buffer);
+    ret = eGbmCreateImageKHRHook(dpy, ctx, target, buffer, attribs);
+    EGBM_TRACE2(create_image_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLImage
+TraceCreateImage(EGLDisplay dpy,
+                 EGLContext ctx,
+                 EGLenum target,
+                 EGLClientBuffer buffer,
+                 const EGLAttrib* attribs)
+{
+    EGLImage ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CREATE_IMAGE], 1);
+
+    EGBM_TRACE3(create_image_entry, dpy, target, buffer);
+    ret = eGbmCreateImageHook(dpy, ctx, target, buffer, attribs);
+    EGBM_TRACE2(create_image_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLSurface
+TraceCreatePbufferSurface(EGLDisplay dpy,
+                          EGLConfig config,
+                          const EGLint *attribs)
+{
+    EGLSurface ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CREATE_PBUFFER_SURFACE], 1);
+
+    EGBM_TRACE2(create_pbuffer_surface_entry, dpy, config);
+    ret = CreatePbufferSurfaceHook(dpy, config, attribs);
+    EGBM_TRACE2(create_pbuffer_surface_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLSurface
+TraceCreatePlatformPixmapSurface(EGLDisplay dpy,
+                                 EGLConfig config,
+                                 void *nativePixmap,
+                                 const EGLAttrib *attribs)
+{
+    EGLSurface ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CREATE_PLATFORM_PIXMAP_SURFACE], 1);
+
+    EGBM_TRACE2(create_platform_pixmap_surface_entry, dpy, config);
+    ret = CreatePlatformPixmapSurfaceHook(dpy, config, nativePixmap, attribs);
+    EGBM_TRACE2(create_platform_pixmap_surface_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLSurface
+TraceCreatePlatformWindowSurface(EGLDisplay dpy,
+                                 EGLConfig config,
+                                 void* nativeWin,
+                                 const EGLAttrib* attribs)
+{
+    EGLSurface ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_CREATE_PLATFORM_WINDOW_SURFACE], 1);
+
+    if (eGbmRecording && nativeWin) {
+        const struct gbm_surface* s = nativeWin;
+        int64_t args[GBM_RECORD_MAX_ARGS];
+        unsigned int n = 0;
+        unsigned int i;
+
+        args[n++] = EGBM_RECORD_ARG(nativeWin);
+        args[n++] = s->v0.width;
+        args[n++] = s->v0.height;
+        args[n++] = s->v0.format;
+        args[n++] = s->v0.flags;
+        args[n++] = s->v0.count;
+        for (i = 0; i < s->v0.count && n < ARRAY_LEN(args); i++)
+            args[n++] = (int64_t)s->v0.modifiers[i];
+
+        eGbmRecordEvent(GBM_RECORD_OP_window_surface_desc, n, args);
+    }
+
+    EGBM_TRACE3(create_platform_window_surface_entry, dpy, config, nativeWin);
+    ret = eGbmCreatePlatformWindowSurfaceHook(dpy, config, nativeWin, attribs);
+    EGBM_TRACE2(create_platform_window_surface_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceDestroyImage(EGLDisplay dpy, EGLImage image)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_DESTROY_IMAGE], 1);
+
+    EGBM_TRACE2(destroy_image_entry, dpy, image);
+    ret = eGbmDestroyImageHook(dpy, image);
+    EGBM_TRACE3(destroy_image_return, dpy, image, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceDestroySurface(EGLDisplay dpy, EGLSurface eglSurf)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_DESTROY_SURFACE], 1);
+
+    EGBM_TRACE2(destroy_surface_entry, dpy, eglSurf);
+    ret = eGbmDestroySurfaceHook(dpy, eglSurf);
+    EGBM_TRACE3(destroy_surface_return, dpy, eglSurf, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceGetConfigAttrib(EGLDisplay dpy,
+                     EGLConfig config,
+                     EGLint attribute,
+                     EGLint* value)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_GET_CONFIG_ATTRIB], 1);
+
+    EGBM_TRACE3(get_config_attrib_entry, dpy, config, attribute);
+    ret = eGbmGetConfigAttribHook(dpy, config, attribute, value);
+    EGBM_TRACE3(get_config_attrib_return, dpy, ret,
+                (ret && value) ? *value : 0);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceInitialize(EGLDisplay dpy, EGLint* major, EGLint* minor)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_INITIALIZE], 1);
+
+    EGBM_TRACE1(initialize_entry, dpy);
+    ret = eGbmInitializeHook(dpy, major, minor);
+    EGBM_TRACE2(initialize_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TracePresentationTime(EGLDisplay dpy, EGLSurface surface, EGLnsecsANDROID time)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_PRESENTATION_TIME], 1);
+
+    EGBM_TRACE3(presentation_time_entry, dpy, surface, time);
+    ret = eGbmPresentationTimeHook(dpy, surface, time);
+    EGBM_TRACE3(presentation_time_return, dpy, surface, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceQueryDisplayAttrib(EGLDisplay dpy, EGLint name, EGLAttrib *value)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_QUERY_DISPLAY_ATTRIB], 1);
+
+    EGBM_TRACE2(query_display_attrib_entry, dpy, name);
+    ret = eGbmQueryDisplayAttribHook(dpy, name, value);
+    EGBM_TRACE3(query_display_attrib_return, dpy, ret,
+                (ret && value) ? *value : 0);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceTerminate(EGLDisplay dpy)
+{
+    EGLBoolean ret;
+
+    eGbmStatsAdd(&HookCalls[HOOK_TERMINATE], 1);
+
+    EGBM_TRACE1(terminate_entry, dpy);
+    ret = eGbmTerminateHook(dpy);
+    EGBM_TRACE2(terminate_return, dpy, ret);
+
+    return ret;
+}
+
+static EGLBoolean
+TraceIsValidNativeDisplay(void *data, void *nativeDpy)
+{
+    EGLBoolean ret;
+
+    EGBM_TRACE1(is_valid_native_display_entry, nativeDpy);
+    ret = eGbmIsValidNativeDisplayExport(data, nativeDpy);
+    EGBM_TRACE2(is_valid_native_display_return, nativeDpy, ret);
+
+    return ret;
+}
+
+static EGLDisplay
+TraceGetPlatformDisplay(void *data,
+                        EGLenum platform,
+                        void *nativeDpy,
+                        const EGLAttrib *attribs)
+{
+    EGLDisplay ret;
+
+    EGBM_TRACE2(get_platform_display_entry, platform, nativeDpy);
+    ret = eGbmGetPlatformDisplayExport(data, platform, nativeDpy, attribs);
+    EGBM_TRACE2(get_platform_display_return, nativeDpy, ret);
+
+    return ret;
+}
+
+static const char*
+TraceQueryString(void *data, EGLDisplay dpy, EGLExtPlatformString name)
+{
+    const char* ret;
+
+    EGBM_TRACE2(query_string_entry, dpy, name);
+    ret = eGbmQueryStringExport(data, dpy, name);
+    EGBM_TRACE2(query_string_return, dpy, ret);
+
+    return ret;
+}
+
+static void*
+TraceGetInternalHandle(EGLDisplay dpy, EGLenum type, void *handle)
+{
+    void* ret;
+
+    EGBM_TRACE3(get_internal_handle_entry, dpy, type, handle);
+    ret = eGbmGetInternalHandleExport(dpy, type, handle);
+    EGBM_TRACE2(get_internal_handle_return, dpy, ret);
+
+    return ret;
+}
+
 typedef struct GbmEglHookRec {
     const char *name;
     void *func;
+    GbmHookId id;
 } GbmEglHook;
 
 static const GbmEglHook EglHooksMap[] = {
     /* Keep names in ascending order */
-    { "eglChooseConfig", eGbmChooseConfigHook },
-    { "eglCreatePbufferSurface", CreatePbufferSurfaceHook },
-    { "eglCreatePlatformPixmapSurface", CreatePlatformPixmapSurfaceHook },
-    { "eglCreatePlatformWindowSurface", eGbmCreatePlatformWindowSurfaceHook },
-    { "eglDestroySurface", eGbmDestroySurfaceHook },
-    { "eglGetConfigAttrib", eGbmGetConfigAttribHook },
-    { "eglInitialize", eGbmInitializeHook },
-    { "eglTerminate", eGbmTerminateHook },
+    { "eglChooseConfig", TraceChooseConfig, HOOK_CHOOSE_CONFIG },
+    { "eglCreateImage", TraceCreateImage, HOOK_CREATE_IMAGE },
+    { "eglCreateImageKHR", TraceCreateImageKHR, HOOK_CREATE_IMAGE_KHR },
+    { "eglCreatePbufferSurface", TraceCreatePbufferSurface, HOOK_CREATE_PBUFFER_SURFACE },
+    { "eglCreatePlatformPixmapSurface", TraceCreatePlatformPixmapSurface, HOOK_CREATE_PLATFORM_PIXMAP_SURFACE },
+    { "eglCreatePlatformWindowSurface", TraceCreatePlatformWindowSurface, HOOK_CREATE_PLATFORM_WINDOW_SURFACE },
+    { "eglDestroyImage", TraceDestroyImage, HOOK_DESTROY_IMAGE },
+    { "eglDestroyImageKHR", TraceDestroyImage, HOOK_DESTROY_IMAGE },
+    { "eglDestroySurface", TraceDestroySurface, HOOK_DESTROY_SURFACE },
+    { "eglGetConfigAttrib", TraceGetConfigAttrib, HOOK_GET_CONFIG_ATTRIB },
+    { "eglInitialize", TraceInitialize, HOOK_INITIALIZE },
+    { "eglPresentationTimeANDROID", TracePresentationTime, HOOK_PRESENTATION_TIME },
+    { "eglQueryDisplayAttribEXT", TraceQueryDisplayAttrib, HOOK_QUERY_DISPLAY_ATTRIB },
+    { "eglQueryDisplayAttribKHR", TraceQueryDisplayAttrib, HOOK_QUERY_DISPLAY_ATTRIB },
+    { "eglTerminate", TraceTerminate, HOOK_TERMINATE },
 };
 
 static int
@@ -136,10 +492,34 @@ HookCmp(const void* elemA, const void* elemB)
     return strcmp(key, hook->name);
 }
 
+void
+eGbmStatsWriteHooks(FILE* f)
+{
+    bool written[HOOK_COUNT] = { false };
+    GbmHookId id;
+    unsigned int i;
+
+    fprintf(f, "# HELP egl_gbm_hook_calls EGL calls through each hook. "
+            "Aliases are counted under the first name\n"
+            "# TYPE egl_gbm_hook_calls counter\n");
+
+    for (i = 0; i < ARRAY_LEN(EglHooksMap); i++) {
+        id = EglHooksMap[i].id;
+
+        if (written[id]) continue;
+
+        written[id] = true;
+        fprintf(f, "egl_gbm_hook_calls{hook=\"%s\"} %" PRIu64 "\n",
+                EglHooksMap[i].name,
+                __atomic_load_n(&HookCalls[id], __ATOMIC_RELAXED));
+    }
+}
+
 static void*
 GetHookAddressExport(void *data, const char *name)
 {
     GbmEglHook *hook;
+    void *func = NULL;
     (void)data;
 
     hook = (GbmEglHook*)bsearch((const void*)name,
@@ -148,14 +528,18 @@ GetHookAddressExport(void *data, const char *name)
                                 sizeof(GbmEglHook),
                                 HookCmp);
 
-    if (hook) return hook->func;
+    if (hook) func = hook->func;
 
-    return NULL;
+    EGBM_TRACE2(get_hook_address, name, func);
+
+    return func;
 }
 
 static EGLBoolean
 UnloadPlatformExport(void *data)
 {
+    EGBM_TRACE1(unload_platform, data);
+    eGbmRecordFlush();
     DestroyPlatformData(data);
     return EGL_TRUE;
 }
@@ -177,6 +561,9 @@ loadEGLExternalPlatform(int major, int minor,
 
     platform->platform = EGL_PLATFORM_GBM_KHR;
 
+    eGbmRecordInit();
+    eGbmStatsInit();
+
     platform->data = (void *)CreatePlatformData(driver);
     if (platform->data == NULL) {
         return EGL_FALSE;
@@ -185,10 +572,10 @@ loadEGLExternalPlatform(int major, int minor,
     platform->exports.unloadEGLExternalPlatform = UnloadPlatformExport;
 
     platform->exports.getHookAddress       = GetHookAddressExport;
-    platform->exports.isValidNativeDisplay = eGbmIsValidNativeDisplayExport;
-    platform->exports.getPlatformDisplay   = eGbmGetPlatformDisplayExport;
-    platform->exports.queryString          = eGbmQueryStringExport;
-    platform->exports.getInternalHandle    = eGbmGetInternalHandleExport;
+    platform->exports.isValidNativeDisplay = TraceIsValidNativeDisplay;
+    platform->exports.getPlatformDisplay   = TraceGetPlatformDisplay;
+    platform->exports.queryString          = TraceQueryString;
+    platform->exports.getInternalHandle    = TraceGetInternalHandle;
 
     return EGL_TRUE;
 }
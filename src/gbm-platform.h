@@ -8,12 +8,18 @@
 #define GBM_PLATFORM_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
 #include <gbm.h>
 
+#include "gbm-worker.h"
+#include "gbm-modifier.h"
+
 /*
  * <GBM_EXTERNAL_VERSION_MAJOR>.<GBM_EXTERNAL_VERSION_MINOR>.
  * <GBM_EXTERNAL_VERSION_MICRO> defines the EGL external Wayland
@@ -52,6 +58,28 @@
 
 #define EGBM_EXPORT __attribute__ ((visibility ("default")))
 
+/*
+ * The EGL extensions this platform cares about, as indices into a
+ * GbmExtensionSet bitmask.
+ */
+typedef enum {
+#define DO_EGL_EXT(_EXT) GBM_##_EXT,
+#include "gbm-egl-extensions.h"
+#undef DO_EGL_EXT
+    GBM_EGL_EXTENSION_COUNT
+} GbmEglExtension;
+
+typedef uint64_t GbmExtensionSet;
+
+_Static_assert(GBM_EGL_EXTENSION_COUNT <= sizeof(GbmExtensionSet) * 8,
+               "Too many extensions for GbmExtensionSet");
+
+static inline bool
+eGbmHasExtension(GbmExtensionSet set, GbmEglExtension ext)
+{
+    return (set & ((GbmExtensionSet)1 << ext)) != 0;
+}
+
 typedef struct GbmPlatformDataRec {
     struct {
 #define DO_EGL_FUNC(_PROTO, _FUNC) \
@@ -64,11 +92,95 @@ typedef struct GbmPlatformDataRec {
         PEGLEXTFNSETERROR setError;
     } driver;
 
+    /* Set of GbmEglExtension supported by the driver as client extensions */
+    GbmExtensionSet clientExts;
+
     bool supportsDisplayReference;
 
+    struct {
+        /* NULL unless the persistent cache is enabled. See gbm-cache.h */
+        char* path;
+        uint64_t driverIno;
+        int64_t driverSize;
+        int64_t driverMtimeSec;
+        int64_t driverMtimeNsec;
+        uint64_t extNamesHash;
+    } cache;
+
+    /* Runs deferred work, such as asynchronous window surface teardown */
+    GbmWorker worker;
+
+    /*
+     * Runs egl_gbm_surface_read_front_buffer() copies, which take
+     * milliseconds each, so that they don't hold up <worker> or wait behind
+     * teardown queued there.
+     */
+    GbmWorker readbackWorker;
+
+    /*
+     * From EGL_GBM_ASYNC_DESTROY. When set, the driver objects behind a
+     * window surface are destroyed on <worker> once the last reference to the
+     * surface goes away, rather than in the thread that released it.
+     */
+    bool asyncDestroy;
+
+    /*
+     * From EGL_GBM_DEFER_ACQUIRE_WAIT. When set, acquiring a window surface
+     * frame doesn't wait for its rendering to complete on the CPU. The
+     * consumer waits on the frame's fence instead, see
+     * egl_gbm_surface_get_acquire_sync().
+     */
+    bool deferAcquireWait;
+
+    /*
+     * From EGL_GBM_DMA_BUF_CACHE_SIZE. How many EGL_LINUX_DMA_BUF_EXT imports
+     * no longer referenced by the application each display keeps for reuse.
+     * 0 disables caching of dma-buf imports.
+     */
+    unsigned int dmaBufCacheSize;
+
+    /*
+     * From EGL_GBM_DMA_BUF_CACHE_MB. How much dma-buf memory those idle
+     * imports may keep alive.
+     */
+    uint64_t dmaBufCacheBytes;
+
+    /*
+     * From EGL_GBM_DMA_BUF_CACHE_AGE_MS. How long an idle import is kept
+     * without being reused. 0 keeps idle imports regardless of age.
+     */
+    uint64_t dmaBufCacheAgeNs;
+
+    /*
+     * From EGL_GBM_BO_IMAGE_CACHE. When set, the images of gbm_bos passed as
+     * EGL_NATIVE_PIXMAP_KHR are cached in the bo's user data, see
+     * egl-gbm-ext.h.
+     */
+    bool boImageCache;
+
+    /*
+     * From EGL_GBM_WAIT_TIMEOUT_MS. How long a wait on a window surface
+     * frame's fence may take before it is reported as a stall on stderr. 0
+     * disables the watchdog, and fences are waited on without a timeout.
+     */
+    uint64_t waitTimeoutNs;
+
+    /*
+     * From EGL_GBM_WAIT_FALLBACK. When set, a stalled wait gives up, and the
+     * frame is treated as unavailable, so that a hung client can't block the
+     * compositor.
+     */
+    bool waitFallback;
+
+    /* Scanout results reported by the compositor, see gbm-modifier.h */
+    GbmScanoutCache scanout;
+
     const char * (* ptr_gbm_device_get_backend_name) (struct gbm_device *gbm);
 } GbmPlatformData;
 
+/* Writes the number of calls through each EGL hook, see gbm-stats.h */
+void eGbmStatsWriteHooks(FILE* f);
+
 EGBM_EXPORT EGLBoolean loadEGLExternalPlatform(int major, int minor,
                                                const EGLExtDriver *driver,
                                                EGLExtPlatform *platform);
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_RECORD_FORMAT_H
+#define GBM_RECORD_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the call recordings written when EGL_GBM_RECORD is set, shared
+ * with the replay tool. All fields are in native byte order.
+ *
+ * The file starts with a GbmRecordFileHeader, followed by <numOps> operation
+ * names, each a uint32_t length followed by that many characters. The names
+ * are the tracepoint names from gbm-trace-probes.h plus the record-only
+ * payload operations, so readers map operations by name rather than by
+ * number.
+ *
+ * Then follows a sequence of GbmRecordEvent, each immediately followed by
+ * <argc> int64_t arguments.
+ */
+
+#define GBM_RECORD_MAGIC "EGBMRPLY"
+#define GBM_RECORD_VERSION 1
+
+/* Record-only operations carrying data the tracepoints don't */
+#define GBM_RECORD_OP_CHOOSE_CONFIG_ATTRIBS "choose_config_attribs"
+#define GBM_RECORD_OP_WINDOW_SURFACE_DESC "window_surface_desc"
+
+typedef struct GbmRecordFileHeaderRec {
+    char magic[8];
+    uint32_t version;
+    uint32_t numOps;
+} GbmRecordFileHeader;
+
+typedef struct GbmRecordEventRec {
+    uint16_t op;
+    uint16_t argc;
+    uint32_t tid;
+    uint64_t timestampNs;
+} GbmRecordEvent;
+
+#endif /* GBM_RECORD_FORMAT_H */
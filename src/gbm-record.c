@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-record.h"
+#include "gbm-trace.h"
+
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_BUFFER_SIZE (64 * 1024)
+
+bool eGbmRecording = false;
+
+static const char* const OpNames[GBM_RECORD_OP_COUNT] = {
+#define DO_TRACE_PROBE(_NAME) #_NAME,
+#include "gbm-trace-probes.h"
+#undef DO_TRACE_PROBE
+    GBM_RECORD_OP_CHOOSE_CONFIG_ATTRIBS,
+    GBM_RECORD_OP_WINDOW_SURFACE_DESC,
+};
+
+static pthread_once_t recordOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t recordMutex = PTHREAD_MUTEX_INITIALIZER;
+static int recordFd = -1;
+static uint8_t recordBuffer[RECORD_BUFFER_SIZE];
+static size_t recordBufferUsed;
+
+/* Must be called with recordMutex held */
+static void
+FlushLocked(void)
+{
+    size_t done = 0;
+    ssize_t written;
+
+    while (done < recordBufferUsed) {
+        written = write(recordFd, recordBuffer + done, recordBufferUsed - done);
+
+        if (written <= 0) {
+            /* Stop recording rather than produce a corrupt file */
+            eGbmRecording = false;
+            break;
+        }
+
+        done += written;
+    }
+
+    recordBufferUsed = 0;
+}
+
+/* Must be called with recordMutex held */
+static void
+AppendLocked(const void* data, size_t size)
+{
+    if (recordBufferUsed + size > sizeof(recordBuffer)) FlushLocked();
+
+    memcpy(recordBuffer + recordBufferUsed, data, size);
+    recordBufferUsed += size;
+}
+
+static void
+RecordInitOnce(void)
+{
+    const char* path = getenv("EGL_GBM_RECORD");
+    GbmRecordFileHeader hdr;
+    uint32_t len;
+    unsigned int i;
+
+    if (!path || !path[0]) return;
+
+    recordFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (recordFd < 0) return;
+
+    memcpy(hdr.magic, GBM_RECORD_MAGIC, sizeof(hdr.magic));
+    hdr.version = GBM_RECORD_VERSION;
+    hdr.numOps = GBM_RECORD_OP_COUNT;
+
+    pthread_mutex_lock(&recordMutex);
+
+    AppendLocked(&hdr, sizeof(hdr));
+
+    for (i = 0; i < GBM_RECORD_OP_COUNT; i++) {
+        len = strlen(OpNames[i]);
+        AppendLocked(&len, sizeof(len));
+        AppendLocked(OpNames[i], len);
+    }
+
+    eGbmRecording = true;
+
+    pthread_mutex_unlock(&recordMutex);
+}
+
+void
+eGbmRecordInit(void)
+{
+    pthread_once(&recordOnce, RecordInitOnce);
+}
+
+void
+eGbmRecordFlush(void)
+{
+    if (recordFd < 0) return;
+
+    pthread_mutex_lock(&recordMutex);
+    if (recordFd >= 0) FlushLocked();
+    pthread_mutex_unlock(&recordMutex);
+}
+
+void
+eGbmRecordEvent(GbmRecordOp op, unsigned int argc, const int64_t* args)
+{
+    GbmRecordEvent ev;
+
+    if (argc > GBM_RECORD_MAX_ARGS) argc = GBM_RECORD_MAX_ARGS;
+
+    ev.op = op;
+    ev.argc = argc;
+    ev.tid = syscall(SYS_gettid);
+    ev.timestampNs = eGbmTraceNow();
+
+    pthread_mutex_lock(&recordMutex);
+
+    if (eGbmRecording) {
+        AppendLocked(&ev, sizeof(ev));
+        AppendLocked(args, argc * sizeof(*args));
+    }
+
+    pthread_mutex_unlock(&recordMutex);
+}
+
+/*
+ * Processes rarely unload the platform, so flush whatever is left at exit.
+ * Hooks may still run on other threads, so recording stops under the mutex
+ * before the file is closed.
+ */
+static void __attribute__((destructor))
+RecordFini(void)
+{
+    if (recordFd < 0) return;
+
+    pthread_mutex_lock(&recordMutex);
+
+    if (eGbmRecording) FlushLocked();
+
+    eGbmRecording = false;
+    close(recordFd);
+    recordFd = -1;
+
+    pthread_mutex_unlock(&recordMutex);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_RECORD_H
+#define GBM_RECORD_H
+
+#include "gbm-record-format.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Opt-in recorder of every tracepoint, with its arguments and a timestamp, to
+ * the file named by the EGL_GBM_RECORD environment variable. The recording can
+ * be replayed against a stub driver with the egl-gbm-replay tool.
+ */
+
+typedef enum {
+#define DO_TRACE_PROBE(_NAME) GBM_RECORD_OP_##_NAME,
+#include "gbm-trace-probes.h"
+#undef DO_TRACE_PROBE
+    GBM_RECORD_OP_choose_config_attribs,
+    GBM_RECORD_OP_window_surface_desc,
+    GBM_RECORD_OP_COUNT
+} GbmRecordOp;
+
+/* Longest argument list a single event can carry */
+#define GBM_RECORD_MAX_ARGS 256
+
+extern bool eGbmRecording;
+
+void eGbmRecordInit(void);
+void eGbmRecordFlush(void);
+void eGbmRecordEvent(GbmRecordOp op, unsigned int argc, const int64_t* args);
+
+#endif /* GBM_RECORD_H */
@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Process-wide counters served by the stats endpoint, see gbm-stats.h.
+ * DO_STAT(name, type, help), where type is "gauge" or "counter".
+ */
+DO_STAT(displays, "gauge", "GBM platform displays alive")
+DO_STAT(surfaces, "gauge", "Window surfaces alive")
+DO_STAT(handles, "gauge", "Objects in the handle table")
+DO_STAT(images_acquired, "counter", "Frames acquired from window surface streams")
+DO_STAT(images_locked, "counter", "Frames locked from window surfaces")
+DO_STAT(import_failures, "counter", "Frame locks that failed to import the frame's buffer")
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-stats.h"
+#include "gbm-platform.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+bool eGbmStatsEnabled = false;
+GbmStats eGbmStats;
+
+static const char* const ErrorNames[GBM_STATS_NUM_ERROR_CODES] = {
+    "EGL_SUCCESS",
+    "EGL_NOT_INITIALIZED",
+    "EGL_BAD_ACCESS",
+    "EGL_BAD_ALLOC",
+    "EGL_BAD_ATTRIBUTE",
+    "EGL_BAD_CONFIG",
+    "EGL_BAD_CONTEXT",
+    "EGL_BAD_CURRENT_SURFACE",
+    "EGL_BAD_DISPLAY",
+    "EGL_BAD_MATCH",
+    "EGL_BAD_NATIVE_PIXMAP",
+    "EGL_BAD_NATIVE_WINDOW",
+    "EGL_BAD_PARAMETER",
+    "EGL_BAD_SURFACE",
+    "EGL_CONTEXT_LOST",
+    "other",
+};
+
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+static struct sockaddr_un statsAddr;
+static int listenFd = -1;
+/* Written to once to stop the thread */
+static int quitPipe[2] = { -1, -1 };
+static pthread_t statsThread;
+static bool threadStarted;
+/* The process the thread runs in, see StatsFini() */
+static pid_t statsPid;
+
+void
+eGbmStatsCountError(int32_t error)
+{
+    unsigned int i = error - EGL_SUCCESS;
+
+    if (i >= GBM_STATS_NUM_ERROR_CODES) i = GBM_STATS_NUM_ERROR_CODES - 1;
+
+    eGbmStatsAdd(&eGbmStats.errors[i], 1);
+}
+
+static uint64_t
+Load(const uint64_t* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void
+WriteStats(int fd)
+{
+    char* text = NULL;
+    size_t size = 0;
+    size_t done = 0;
+    ssize_t sent;
+    unsigned int i;
+    FILE* f = open_memstream(&text, &size);
+
+    if (!f) return;
+
+#define DO_STAT(_NAME, _TYPE, _HELP)                                    \
+    fprintf(f, "# HELP egl_gbm_" #_NAME " " _HELP "\n"                   \
+            "# TYPE egl_gbm_" #_NAME " " _TYPE "\n"                      \
+            "egl_gbm_" #_NAME " %" PRIu64 "\n", Load(&eGbmStats._NAME));
+#include "gbm-stats-counters.h"
+#undef DO_STAT
+
+    fprintf(f, "# HELP egl_gbm_errors EGL errors set, by code\n"
+            "# TYPE egl_gbm_errors counter\n");
+
+    for (i = 0; i < GBM_STATS_NUM_ERROR_CODES; i++) {
+        fprintf(f, "egl_gbm_errors{code=\"%s\"} %" PRIu64 "\n",
+                ErrorNames[i], Load(&eGbmStats.errors[i]));
+    }
+
+    eGbmStatsWriteHooks(f);
+
+    if (fclose(f)) {
+        free(text);
+        return;
+    }
+
+    /* The client may hang up early. Don't let that raise SIGPIPE */
+    while (done < size) {
+        sent = send(fd, text + done, size - done, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) break;
+
+        done += sent;
+    }
+
+    free(text);
+}
+
+static void*
+StatsThread(void* arg)
+{
+    struct pollfd fds[2] = {
+        { .fd = listenFd, .events = POLLIN },
+        { .fd = quitPipe[0], .events = POLLIN },
+    };
+    int client;
+
+    (void)arg;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[1].revents) break;
+
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        client = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (client < 0) continue;
+
+        WriteStats(client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+/* Returns true if something is listening on <statsAddr> */
+static bool
+IsAddressLive(void)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool live;
+
+    if (fd < 0) return true;
+
+    live = !connect(fd, (const struct sockaddr*)&statsAddr, sizeof(statsAddr));
+    close(fd);
+
+    return live;
+}
+
+static void
+StatsInitOnce(void)
+{
+    const char* path = getenv("EGL_GBM_STATS_SOCKET");
+
+    if (!path || !path[0] || strlen(path) >= sizeof(statsAddr.sun_path))
+        return;
+
+    statsAddr.sun_family = AF_UNIX;
+    strcpy(statsAddr.sun_path, path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listenFd < 0) return;
+
+    if (bind(listenFd, (const struct sockaddr*)&statsAddr, sizeof(statsAddr))) {
+        /* Replace the socket of a process that has exited */
+        if (errno != EADDRINUSE || IsAddressLive() ||
+            unlink(path) ||
+            bind(listenFd, (const struct sockaddr*)&statsAddr,
+                 sizeof(statsAddr)))
+            goto fail;
+    }
+
+    if (listen(listenFd, 4)) goto fail_bound;
+
+    if (pipe2(quitPipe, O_CLOEXEC)) goto fail_bound;
+
+    /* Counting must start before any object can be created */
+    eGbmStatsEnabled = true;
+
+    if (pthread_create(&statsThread, NULL, StatsThread, NULL)) {
+        eGbmStatsEnabled = false;
+        close(quitPipe[0]);
+        close(quitPipe[1]);
+        quitPipe[0] = quitPipe[1] = -1;
+        goto fail_bound;
+    }
+
+    threadStarted = true;
+    statsPid = getpid();
+
+    return;
+
+fail_bound:
+    unlink(path);
+
+fail:
+    close(listenFd);
+    listenFd = -1;
+}
+
+void
+eGbmStatsInit(void)
+{
+    pthread_once(&statsOnce, StatsInitOnce);
+}
+
+static void __attribute__((destructor))
+StatsFini(void)
+{
+    static const char quit = 0;
+
+    /*
+     * A child forked after the thread started inherits the pipe and the
+     * socket path, but not the thread. Leave them to the parent.
+     */
+    if (!threadStarted || getpid() != statsPid) return;
+
+    if (write(quitPipe[1], &quit, sizeof(quit)) == sizeof(quit))
+        pthread_join(statsThread, NULL);
+
+    unlink(statsAddr.sun_path);
+}
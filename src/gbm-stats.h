@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_STATS_H
+#define GBM_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Opt-in statistics endpoint. When the EGL_GBM_STATS_SOCKET environment
+ * variable names a path, a background thread listens on a Unix stream socket
+ * there, and writes a snapshot of the counters below to each client that
+ * connects, in the Prometheus text format, before closing the connection.
+ *
+ * Counters are updated with relaxed atomics, and not at all unless the
+ * endpoint is enabled, so that the hot paths take no locks.
+ */
+
+/* EGL_SUCCESS through EGL_CONTEXT_LOST, and one for any other code */
+#define GBM_STATS_NUM_ERROR_CODES 16
+
+typedef struct GbmStatsRec {
+#define DO_STAT(_NAME, _TYPE, _HELP) uint64_t _NAME;
+#include "gbm-stats-counters.h"
+#undef DO_STAT
+
+    /* Errors set through eGbmSetError(), by EGL error code */
+    uint64_t errors[GBM_STATS_NUM_ERROR_CODES];
+} GbmStats;
+
+extern bool eGbmStatsEnabled;
+extern GbmStats eGbmStats;
+
+static inline void
+eGbmStatsAdd(uint64_t* counter, int64_t n)
+{
+    if (__builtin_expect(eGbmStatsEnabled, 0))
+        __atomic_fetch_add(counter, (uint64_t)n, __ATOMIC_RELAXED);
+}
+
+#define EGBM_STAT_ADD(_NAME, _N) eGbmStatsAdd(&eGbmStats._NAME, (_N))
+
+void eGbmStatsInit(void);
+void eGbmStatsCountError(int32_t error);
+
+#endif /* GBM_STATS_H */
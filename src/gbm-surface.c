@@ -7,34 +7,108 @@
 #include "gbm-surface.h"
 #include "gbm-display.h"
 #include "gbm-utils.h"
+#include "gbm-trace.h"
+#include "gbm-stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <EGL/eglext.h>
 #include <gbmint.h>
+#include <drm_fourcc.h>
 #include <unistd.h>
-
-#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+#include <pthread.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#ifndef EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV
+#define EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV 0x3378
+#endif
 
 #define MAX_STREAM_IMAGES 10
 
 // One front, one back.
 #define WINDOW_STREAM_FIFO_LENGTH 2
 
+/* Frames that may have a presentation time set ahead of their acquire */
+#define PRESENT_TIME_QUEUE_LENGTH 8
+
+/* Image events kept per surface for stall reports */
+#define SURF_HISTORY_LENGTH 16
+
+static const EGLint signaledSyncAttrs[] = {
+    EGL_SYNC_STATUS_KHR, EGL_SIGNALED_KHR,
+    EGL_NONE
+};
+
 typedef struct GbmSurfaceImageRec {
     EGLImage image;
     struct gbm_bo* bo;
     struct GbmSurfaceImageRec* nextAcquired;
-    bool locked;
+    /*
+     * Locks held on the image's frame. The frame goes back to the stream
+     * when the last one is released.
+     */
+    unsigned int lockCount;
+    /* Bytes of image memory, known once the image has been imported */
+    uint64_t size;
+    /*
+     * With deferred acquire waits, the fence passed to the acquire of the
+     * image's current frame, which signals when rendering completes.
+     */
+    EGLSyncKHR acquireSync;
+    /* Whether the bo was sent over the surface's export socket */
+    bool exported;
+    /* Locks held by frames exported and not yet released by the receiver */
+    unsigned int exportLocks;
+    /* The frame's target presentation time, or 0 if it has none */
+    uint64_t presentNs;
 } GbmSurfaceImage;
 
+typedef struct GbmPresentTimeRec {
+    uint64_t frame;
+    uint64_t timeNs;
+} GbmPresentTime;
+
+typedef enum {
+    SURF_EVENT_ADD,
+    SURF_EVENT_REMOVE,
+    SURF_EVENT_ACQUIRE,
+    SURF_EVENT_LOCK,
+    SURF_EVENT_RELEASE,
+    SURF_EVENT_DROP,
+} GbmSurfaceEventType;
+
+static const char* const SurfEventNames[] = {
+    [SURF_EVENT_ADD] = "add",
+    [SURF_EVENT_REMOVE] = "remove",
+    [SURF_EVENT_ACQUIRE] = "acquire",
+    [SURF_EVENT_LOCK] = "lock",
+    [SURF_EVENT_RELEASE] = "release",
+    [SURF_EVENT_DROP] = "drop",
+};
+
+typedef struct GbmSurfaceEventRec {
+    uint64_t timeNs;
+    GbmSurfaceEventType type;
+    int slot;
+} GbmSurfaceEvent;
+
 typedef struct GbmSurfaceRec {
     GbmObject base;
+    /* The gbm_surface this is attached to, until the handle is destroyed */
+    struct gbm_surface* native;
     EGLStreamKHR stream;
     EGLSurface egl;
     EGLSyncKHR sync;
     GbmSurfaceImage images[MAX_STREAM_IMAGES];
+    /* Acquire fences not attached to an image, see acquireSync */
+    EGLSyncKHR syncPool[MAX_STREAM_IMAGES];
+    unsigned int numPooledSyncs;
     struct {
         GbmSurfaceImage *first;
         GbmSurfaceImage *last;
@@ -63,8 +137,71 @@ typedef struct GbmSurfaceRec {
      * eGbmSurfaceReleaseBuffer.
      */
     int numFreeImages;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+
+    /* Image memory accounting, see struct egl_gbm_memory_info */
+    GbmMemoryCounters memory;
+
+    /*
+     * Protects the surface state. Besides the compositor's threads, the
+     * readback worker releases frames when readbacks complete.
+     */
+    pthread_mutex_t mutex;
+
+    /* Queued on the platform worker when teardown is asynchronous */
+    GbmWork teardown;
+
+    /*
+     * The socket frames are exported over. It is known by its inode rather
+     * than its fd, which the application may close and reuse for another.
+     */
+    bool exporting;
+    dev_t exportDev;
+    ino_t exportIno;
+    uint64_t exportSeq;
+
+    /*
+     * Times set with eglPresentationTimeANDROID, by the number of the
+     * producer frame they apply to. The FIFO stream hands frames to the
+     * consumer in order, so the Nth frame acquired is producer frame N.
+     */
+    GbmPresentTime presentTimes[PRESENT_TIME_QUEUE_LENGTH];
+    uint64_t acquiredFrames;
+
+    /*
+     * Set while a thread waits for an acquired frame's rendering with the
+     * surface unlocked, see AcquireSurfImage(). Stream events are left to
+     * that thread meanwhile.
+     */
+    bool acquiring;
+
+    /*
+     * The latest image events, as a ring indexed by the event count. Only
+     * recorded when the wait watchdog is enabled.
+     */
+    GbmSurfaceEvent history[SURF_HISTORY_LENGTH];
+    unsigned int numEvents;
 } GbmSurface;
 
+/* A copy queued with egl_gbm_surface_read_front_buffer() */
+typedef struct GbmReadbackRec {
+    GbmWork work;
+    /* Holds a reference on the surface and a lock on <bo> */
+    GbmSurface* surf;
+    struct gbm_bo* bo;
+    /* The frame's acquire fence, if the acquire didn't wait for it */
+    EGLSyncKHR sync;
+    int slot;
+    void* dst;
+    uint32_t dstStride;
+    uint32_t rowBytes;
+    egl_gbm_readback_callback callback;
+    void* callbackData;
+} GbmReadback;
+
 /*
  * Returns a pointer to a pointer in the NV-private structure that wraps the
  * gbm_surface structure. This pointer is reserved for use by this library.
@@ -91,6 +228,217 @@ SetSurf(struct gbm_surface* s, GbmSurface *surf)
     *priv = surf;
 }
 
+static inline void
+LockSurf(GbmSurface* surf)
+{
+    pthread_mutex_lock(&surf->mutex);
+}
+
+static inline void
+UnlockSurf(GbmSurface* surf)
+{
+    pthread_mutex_unlock(&surf->mutex);
+}
+
+static void
+AddMemory(GbmMemoryCounters* counters,
+          int images, uint64_t imageBytes,
+          int imported, uint64_t importedBytes)
+{
+    __atomic_add_fetch(&counters->numImages, images, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->imageBytes, imageBytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->numImported, imported, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->importedBytes, importedBytes,
+                       __ATOMIC_RELAXED);
+}
+
+/*
+ * Adds <images> and <imported> (each 1, 0 or -1) times <image>'s size to the
+ * surface's and its display's counters.
+ */
+static void
+AccountSurfImage(GbmSurface* surf, const GbmSurfaceImage* image,
+                 int images, int imported)
+{
+    uint64_t imageBytes = (uint64_t)(int64_t)images * image->size;
+    uint64_t importedBytes = (uint64_t)(int64_t)imported * image->size;
+
+    AddMemory(&surf->memory, images, imageBytes, imported, importedBytes);
+    AddMemory(&surf->base.dpy->memory, images, imageBytes,
+              imported, importedBytes);
+}
+
+/*
+ * Stops counting an image's memory once neither the stream nor a gbm_bo
+ * references it any more.
+ */
+static void
+ForgetSurfImage(GbmSurface* surf, GbmSurfaceImage* image)
+{
+    if (image->image == EGL_NO_IMAGE_KHR && !image->bo && image->size) {
+        AccountSurfImage(surf, image, -1, 0);
+        /* Atomic for eGbmSurfaceDumpAll() */
+        __atomic_store_n(&image->size, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+DestroySurfImageBo(GbmSurface* surf, GbmSurfaceImage* image)
+{
+    gbm_bo_destroy(image->bo);
+    image->bo = NULL;
+    image->exported = false;
+    AccountSurfImage(surf, image, 0, -1);
+    ForgetSurfImage(surf, image);
+}
+
+static EGLSyncKHR
+TakeAcquireSync(GbmDisplay* display, GbmSurface* surf)
+{
+    if (surf->numPooledSyncs)
+        return surf->syncPool[--surf->numPooledSyncs];
+
+    return display->data->egl.CreateSyncKHR(display->devDpy,
+                                            EGL_SYNC_FENCE_KHR,
+                                            signaledSyncAttrs);
+}
+
+static void
+PutAcquireSync(GbmDisplay* display, GbmSurface* surf, EGLSyncKHR sync)
+{
+    if (sync == EGL_NO_SYNC_KHR) return;
+
+    if (surf->numPooledSyncs < ARRAY_LEN(surf->syncPool))
+        surf->syncPool[surf->numPooledSyncs++] = sync;
+    else
+        display->data->egl.DestroySyncKHR(display->devDpy, sync);
+}
+
+/* Returns the image's acquire fence to the pool once its frame is done */
+static void
+PutImageSync(GbmDisplay* display, GbmSurface* surf, GbmSurfaceImage* image)
+{
+    PutAcquireSync(display, surf, image->acquireSync);
+    image->acquireSync = EGL_NO_SYNC_KHR;
+}
+
+/* Called with the surface locked */
+static void
+RecordSurfEvent(GbmSurface* surf, GbmSurfaceEventType type, int slot)
+{
+    GbmSurfaceEvent* ev;
+
+    if (!surf->base.dpy->data->waitTimeoutNs) return;
+
+    ev = &surf->history[surf->numEvents++ % ARRAY_LEN(surf->history)];
+    ev->timeNs = eGbmTraceNow();
+    ev->type = type;
+    ev->slot = slot;
+}
+
+/*
+ * Reports a stalled wait, with the surface's recent history on the first
+ * report of a wait. Called with the surface locked.
+ */
+static void
+LogSurfStall(GbmSurface* surf,
+             const char* what,
+             int slot,
+             uint64_t waitedNs,
+             bool history)
+{
+    const GbmSurfaceImage* image;
+    const GbmSurfaceEvent* ev;
+    uint64_t now = eGbmTraceNow();
+    unsigned int numAcquired = 0;
+    unsigned int i;
+
+    for (image = surf->acquiredImages.first;
+         image;
+         image = image->nextAcquired)
+        numAcquired++;
+
+    dprintf(STDERR_FILENO,
+            "egl-gbm: surface %p: %s of image %d not done after %" PRIu64
+            " ms, %u free images, %u frames queued\n",
+            (void*)surf, what, slot, waitedNs / 1000000,
+            surf->numFreeImages, numAcquired);
+
+    if (!history) return;
+
+    i = surf->numEvents > ARRAY_LEN(surf->history) ?
+        surf->numEvents - ARRAY_LEN(surf->history) : 0;
+
+    for (; i < surf->numEvents; i++) {
+        ev = &surf->history[i % ARRAY_LEN(surf->history)];
+        dprintf(STDERR_FILENO,
+                "egl-gbm:   %" PRIu64 " ms ago: %s image %d\n",
+                (now - ev->timeNs) / 1000000, SurfEventNames[ev->type],
+                ev->slot);
+    }
+}
+
+/*
+ * Waits for <sync>, the fence of the frame in image slot <slot> of <surf>.
+ * <locked> tells whether the caller holds the surface lock.
+ *
+ * With the watchdog enabled, each EGL_GBM_WAIT_TIMEOUT_MS the wait goes on
+ * is reported, along with the surface's recent history, and with
+ * EGL_GBM_WAIT_FALLBACK set, the first such timeout ends the wait. Returns
+ * true if the fence signaled.
+ */
+static bool
+WaitSurfSync(GbmSurface* surf,
+             EGLSyncKHR sync,
+             int slot,
+             const char* what,
+             bool locked)
+{
+    GbmDisplay* display = surf->base.dpy;
+    GbmPlatformData* data = display->data;
+    uint64_t timeoutNs = data->waitTimeoutNs;
+    uint64_t start;
+    EGLint status;
+    bool stalled = false;
+
+    if (!timeoutNs) {
+        return data->egl.ClientWaitSyncKHR(display->devDpy, sync, 0,
+                                           EGL_FOREVER_KHR) ==
+               EGL_CONDITION_SATISFIED_KHR;
+    }
+
+    start = eGbmTraceNow();
+
+    while ((status = data->egl.ClientWaitSyncKHR(display->devDpy, sync, 0,
+                                                 timeoutNs)) ==
+           EGL_TIMEOUT_EXPIRED_KHR) {
+        if (!locked) LockSurf(surf);
+        LogSurfStall(surf, what, slot, eGbmTraceNow() - start, !stalled);
+        if (!locked) UnlockSurf(surf);
+
+        stalled = true;
+
+        EGBM_TRACE4(wait_stall, surf, slot, eGbmTraceNow() - start,
+                    data->waitFallback);
+
+        if (data->waitFallback) {
+            dprintf(STDERR_FILENO,
+                    "egl-gbm: surface %p: giving up on image %d\n",
+                    (void*)surf, slot);
+            return false;
+        }
+    }
+
+    if (stalled) {
+        dprintf(STDERR_FILENO,
+                "egl-gbm: surface %p: %s of image %d done after %" PRIu64
+                " ms\n",
+                (void*)surf, what, slot, (eGbmTraceNow() - start) / 1000000);
+    }
+
+    return status == EGL_CONDITION_SATISFIED_KHR;
+}
+
 static bool
 AddSurfImage(GbmDisplay* display, GbmSurface* surf)
 {
@@ -108,6 +456,7 @@ AddSurfImage(GbmDisplay* display, GbmSurface* surf)
                                          NULL);
             if (surf->images[i].image == EGL_NO_IMAGE_KHR) break;
 
+            RecordSurfEvent(surf, SURF_EVENT_ADD, (int)i);
             return true;
         }
     }
@@ -138,10 +487,17 @@ RemoveSurfImage(GbmDisplay* display, GbmSurface* surf, EGLImage img)
              */
             data->egl.DestroyImageKHR(display->devDpy, img);
             surf->images[i].image = EGL_NO_IMAGE_KHR;
-            if (!surf->images[i].locked && surf->images[i].bo) {
-                gbm_bo_destroy(surf->images[i].bo);
-                surf->images[i].bo = NULL;
+            RecordSurfEvent(surf, SURF_EVENT_REMOVE, (int)i);
+
+            /* A locked image's fence stays valid until it is released */
+            if (!surf->images[i].lockCount)
+                PutImageSync(display, surf, &surf->images[i]);
+
+            if (!surf->images[i].lockCount && surf->images[i].bo) {
+                DestroySurfImageBo(surf, &surf->images[i]);
             } else {
+                ForgetSurfImage(surf, &surf->images[i]);
+
                 /*
                  * If the image is currently acquired from the stream and
                  * available for locking, remove it from the acquired images list.
@@ -175,16 +531,32 @@ static bool AcquireSurfImage(GbmDisplay* display, GbmSurface* surf)
     GbmPlatformData* data = display->data;
     EGLDisplay dpy = display->devDpy;
     GbmSurfaceImage* image = NULL;
+    EGLSyncKHR sync = surf->sync;
     EGLImage img;
     unsigned int i;
+    uint64_t frame;
+    GbmPresentTime* present;
     EGLBoolean res;
+    uint64_t waitStart = 0;
+
+    if (data->deferAcquireWait) {
+        /* Each acquired frame gets its own fence for the consumer to wait on */
+        sync = TakeAcquireSync(display, surf);
+
+        if (sync == EGL_NO_SYNC_KHR) {
+            eGbmSetError(data, EGL_BAD_ALLOC);
+            return false;
+        }
+    }
 
     res = data->egl.StreamAcquireImageNV(dpy,
                                          surf->stream,
                                          &img,
-                                         surf->sync);
+                                         sync);
 
     if (!res) {
+        if (data->deferAcquireWait) PutAcquireSync(display, surf, sync);
+
         /*
          * Match Mesa EGL dri2 platform behavior when no buffer is available
          * even though this function is not called from an EGL entry point
@@ -193,8 +565,34 @@ static bool AcquireSurfImage(GbmDisplay* display, GbmSurface* surf)
         return false;
     }
 
-    if (data->egl.ClientWaitSyncKHR(dpy, surf->sync, 0, EGL_FOREVER_KHR) !=
-        EGL_CONDITION_SATISFIED_KHR) {
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        if (surf->images[i].image == img) {
+            image = &surf->images[i];
+            break;
+        }
+    }
+
+    if (EGBM_TRACE_ENABLED(image_acquire)) waitStart = eGbmTraceNow();
+
+    if (!data->deferAcquireWait) {
+        /*
+         * Wait without the surface lock, so that a stalled client doesn't
+         * block releases and other calls on the surface.
+         */
+        surf->acquiring = true;
+        UnlockSurf(surf);
+        res = WaitSurfSync(surf, surf->sync, image ? (int)i : -1,
+                           "rendering", false);
+        LockSurf(surf);
+        surf->acquiring = false;
+    }
+
+    if (!res) {
+        EGBM_TRACE4(image_acquire, surf, -1,
+                    waitStart ? eGbmTraceNow() - waitStart : 0, false);
+        RecordSurfEvent(surf, SURF_EVENT_DROP, image ? (int)i : -1);
+        /* The dropped frame still took its producer frame number */
+        surf->acquiredFrames++;
         /* Release the image back to the stream */
         data->egl.StreamReleaseImageNV(dpy,
                                        surf->stream,
@@ -205,13 +603,23 @@ static bool AcquireSurfImage(GbmDisplay* display, GbmSurface* surf)
         return false;
     }
 
-    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
-        if (surf->images[i].image == img) {
-            image = &surf->images[i];
-            break;
-        }
+    if (data->deferAcquireWait) {
+        if (image)
+            image->acquireSync = sync;
+        else
+            PutAcquireSync(display, surf, sync);
     }
 
+    frame = ++surf->acquiredFrames;
+    present = &surf->presentTimes[frame % ARRAY_LEN(surf->presentTimes)];
+    if (image)
+        image->presentNs = present->frame == frame ? present->timeNs : 0;
+
+    EGBM_TRACE4(image_acquire, surf, (int)i,
+                waitStart ? eGbmTraceNow() - waitStart : 0, true);
+    RecordSurfEvent(surf, SURF_EVENT_ACQUIRE, image ? (int)i : -1);
+    EGBM_STAT_ADD(images_acquired, 1);
+
     if (surf->acquiredImages.last)
         surf->acquiredImages.last->nextAcquired = image;
     else
@@ -229,15 +637,24 @@ PumpSurfEvents(GbmDisplay* display, GbmSurface* surf)
     EGLenum event;
     EGLAttrib aux;
     EGLint evStatus;
+    bool ok = true;
 
-    while (true) {
+    EGBM_TRACE1(pump_events_entry, surf);
+
+    /* A thread acquiring a frame processes the remaining events after it */
+    while (ok && !surf->acquiring) {
         evStatus = data->egl.QueryStreamConsumerEventNV(display->devDpy,
                                                         surf->stream,
                                                         0,
                                                         &event,
                                                         &aux);
 
-        if (evStatus != EGL_TRUE) break;
+        if (evStatus != EGL_TRUE) {
+            ok = (evStatus != EGL_FALSE);
+            break;
+        }
+
+        EGBM_TRACE3(stream_event, surf, event, aux);
 
         switch (event) {
         case EGL_STREAM_IMAGE_AVAILABLE_NV:
@@ -245,10 +662,10 @@ PumpSurfEvents(GbmDisplay* display, GbmSurface* surf)
              * The image must be acquired to clear the IMAGE_AVAILABLE event,
              * so acquire it here rather than in eGbmSurfaceLockFrontBuffer().
              */
-            if (!AcquireSurfImage(display, surf)) return false;
+            ok = AcquireSurfImage(display, surf);
             break;
         case EGL_STREAM_IMAGE_ADD_NV:
-            if (!AddSurfImage(display, surf)) return false;
+            ok = AddSurfImage(display, surf);
             break;
 
         case EGL_STREAM_IMAGE_REMOVE_NV:
@@ -261,123 +678,235 @@ PumpSurfEvents(GbmDisplay* display, GbmSurface* surf)
         }
     }
 
-    return evStatus != EGL_FALSE;
+    EGBM_TRACE2(pump_events_return, surf, ok);
+
+    return ok;
 }
 
-int
-eGbmSurfaceHasFreeBuffers(struct gbm_surface* s)
+static bool
+ImportSurfImage(struct gbm_surface* s, GbmSurface* surf, GbmSurfaceImage* image)
+{
+    GbmPlatformData* data = surf->base.dpy->data;
+    EGLDisplay dpy = surf->base.dpy->devDpy;
+    struct gbm_import_fd_modifier_data buf;
+    uint64_t modifier;
+    uint64_t importStart = 0;
+    EGLint stride; /* XXX support planar formats */
+    EGLint offset; /* XXX support planar formats */
+    int format;
+    int planes;
+    int fd; /* XXX support planar separate memory objects */
+    uint32_t i;
+
+    if (!data->egl.ExportDMABUFImageQueryMESA(dpy,
+                                              image->image,
+                                              &format,
+                                              &planes,
+                                              &modifier)) return false;
+
+    assert(planes == 1); /* XXX support planar formats */
+
+    if (!data->egl.ExportDMABUFImageMESA(dpy, image->image,
+                                         &fd, &stride, &offset)) {
+        return false;
+    }
+
+    if (EGBM_TRACE_ENABLED(bo_import)) importStart = eGbmTraceNow();
+
+    memset(&buf, 0, sizeof(buf));
+    buf.width = s->v0.width;
+    buf.height = s->v0.height;
+    buf.format = s->v0.format;
+    buf.num_fds = 1; /* XXX support planar separate memory objects */
+    buf.fds[0] = fd;
+    buf.strides[0] = stride;
+    buf.offsets[0] = offset;
+    buf.modifier = modifier;
+    image->bo = gbm_bo_import(surf->base.dpy->gbm,
+                              GBM_BO_IMPORT_FD_MODIFIER,
+                              &buf, 0);
+
+    for (i = 0; i < buf.num_fds; i++) {
+        close(buf.fds[i]);
+    }
+
+    EGBM_TRACE4(bo_import, surf, (int)(image - surf->images), image->bo,
+                importStart ? eGbmTraceNow() - importStart : 0);
+
+    if (!image->bo) return false;
+
+    if (!image->size) {
+        __atomic_store_n(&image->size,
+                         (uint64_t)offset + (uint64_t)stride * s->v0.height,
+                         __ATOMIC_RELAXED);
+        AccountSurfImage(surf, image, 1, 1);
+    } else {
+        AccountSurfImage(surf, image, 0, 1);
+    }
+
+    return true;
+}
+
+static int
+SurfaceHasFreeBuffers(struct gbm_surface* s)
 {
     GbmSurface* surf = GetSurf(s);
+    int ret = 0;
 
     if (!surf) return 0;
 
-    if (!PumpSurfEvents(surf->base.dpy, surf)) return 0;
+    LockSurf(surf);
+
+    if (!PumpSurfEvents(surf->base.dpy, surf)) goto done;
+
+    ret = (surf->numFreeImages > 0);
+
+done:
+    UnlockSurf(surf);
 
-    return (surf->numFreeImages > 0);
+    return ret;
 }
 
-struct gbm_bo*
-eGbmSurfaceLockFrontBuffer(struct gbm_surface* s)
+/*
+ * Returns the oldest acquired frame to the stream unseen. It must not be the
+ * only one.
+ */
+static void
+DropFirstFrame(GbmSurface* surf)
 {
-    GbmSurface* surf = GetSurf(s);
+    GbmDisplay* display = surf->base.dpy;
+    GbmSurfaceImage* image = surf->acquiredImages.first;
+
+    assert(image != surf->acquiredImages.last);
+    surf->acquiredImages.first = image->nextAcquired;
+
+    EGBM_TRACE3(image_release, surf, (int)(image - surf->images), image->bo);
+    RecordSurfEvent(surf, SURF_EVENT_DROP, (int)(image - surf->images));
+    display->data->egl.StreamReleaseImageNV(display->devDpy,
+                                            surf->stream,
+                                            image->image,
+                                            EGL_NO_SYNC_KHR);
+    PutImageSync(display, surf, image);
+    assert(surf->numFreeImages < WINDOW_STREAM_FIFO_LENGTH);
+    surf->numFreeImages++;
+}
+
+/*
+ * Returns every acquired frame but the newest to the stream unseen. Used by
+ * the batched lock with EGL_GBM_LOCK_LATEST_FRAME.
+ */
+static void
+DropStaleFrames(GbmSurface* surf)
+{
+    while (surf->acquiredImages.first != surf->acquiredImages.last)
+        DropFirstFrame(surf);
+}
+
+/*
+ * Drops the frames queued ahead of the latest one due by <deadlineNs>, so
+ * that it is locked next. Frames without a presentation time are always due.
+ * Returns false if no frame is due yet.
+ */
+static bool
+DropFramesBefore(GbmSurface* surf, uint64_t deadlineNs)
+{
+    GbmSurfaceImage* due = NULL;
     GbmSurfaceImage* image;
-    GbmPlatformData* data;
-    EGLDisplay dpy;
-    uint32_t i;
 
-    if (!surf) return NULL;
+    for (image = surf->acquiredImages.first;
+         image;
+         image = image->nextAcquired) {
+        if (image->presentNs <= deadlineNs) due = image;
+    }
 
-    data = surf->base.dpy->data;
-    dpy = surf->base.dpy->devDpy;
+    if (!due) return false;
 
-    /* Must pump events to ensure images are created before acquiring them */
-    if (!PumpSurfEvents(surf->base.dpy, surf)) return NULL;
+    while (surf->acquiredImages.first != due) DropFirstFrame(surf);
 
-    if (!surf->acquiredImages.first) return NULL;
+    return true;
+}
 
-    image = surf->acquiredImages.first;
-    assert(image->image);
+/* Locks the oldest acquired frame. Called with the surface locked */
+static struct gbm_bo*
+LockSurfImage(struct gbm_surface* s, GbmSurface* surf)
+{
+    GbmSurfaceImage* image = surf->acquiredImages.first;
 
-    if (!image->bo) {
-        struct gbm_import_fd_modifier_data buf;
-        uint64_t modifier;
-        EGLint stride; /* XXX support planar formats */
-        EGLint offset; /* XXX support planar formats */
-        int format;
-        int planes;
-        int fd; /* XXX support planar separate memory objects */
-
-        if (!data->egl.ExportDMABUFImageQueryMESA(dpy,
-                                                  image->image,
-                                                  &format,
-                                                  &planes,
-                                                  &modifier)) goto fail;
-
-        assert(planes == 1); /* XXX support planar formats */
-
-        if (!data->egl.ExportDMABUFImageMESA(dpy, image->image,
-                                             &fd, &stride, &offset)) {
-            goto fail;
-        }
+    if (!image) return NULL;
 
-        memset(&buf, 0, sizeof(buf));
-        buf.width = s->v0.width;
-        buf.height = s->v0.height;
-        buf.format = s->v0.format;
-        buf.num_fds = 1; /* XXX support planar separate memory objects */
-        buf.fds[0] = fd;
-        buf.strides[0] = stride;
-        buf.offsets[0] = offset;
-        buf.modifier = modifier;
-        image->bo = gbm_bo_import(surf->base.dpy->gbm,
-                                  GBM_BO_IMPORT_FD_MODIFIER,
-                                  &buf, 0);
-
-        for (i = 0; i < buf.num_fds; i++) {
-            close(buf.fds[i]);
-        }
+    assert(image->image);
 
-        if (!image->bo) goto fail;
+    if (!image->bo && !ImportSurfImage(s, surf, image)) {
+        EGBM_STAT_ADD(import_failures, 1);
+        /* XXX Can this be called from outside an EGL entry point? */
+        eGbmSetError(surf->base.dpy->data, EGL_BAD_ALLOC);
+        return NULL;
     }
 
     surf->acquiredImages.first = image->nextAcquired;
     if (!surf->acquiredImages.first)
         surf->acquiredImages.last = NULL;
-    image->locked = true;
+    image->lockCount = 1;
+
+    EGBM_TRACE3(image_lock, surf, (int)(image - surf->images), image->bo);
+    RecordSurfEvent(surf, SURF_EVENT_LOCK, (int)(image - surf->images));
+    EGBM_STAT_ADD(images_locked, 1);
 
     return image->bo;
+}
 
-fail:
-    /* XXX Can this be called from outside an EGL entry point? */
-    eGbmSetError(data, EGL_BAD_ALLOC);
+static struct gbm_bo*
+SurfaceLockFrontBuffer(struct gbm_surface* s)
+{
+    GbmSurface* surf = GetSurf(s);
+    struct gbm_bo* bo = NULL;
 
-    return NULL;
+    if (!surf) return NULL;
+
+    LockSurf(surf);
+
+    /* Must pump events to ensure images are created before acquiring them */
+    if (PumpSurfEvents(surf->base.dpy, surf)) bo = LockSurfImage(s, surf);
+
+    UnlockSurf(surf);
 
+    return bo;
 }
 
-void
-eGbmSurfaceReleaseBuffer(struct gbm_surface* s, struct gbm_bo *bo)
+/*
+ * Drops one lock on <bo>, returning its frame to the stream with the last.
+ * Readbacks call this from the readback worker, so it always locks <surf>.
+ */
+static void
+ReleaseSurfImage(GbmSurface* surf, struct gbm_bo *bo)
 {
-    GbmSurface* surf = GetSurf(s);
-    GbmDisplay* display;
+    GbmDisplay* display = surf->base.dpy;
     EGLImage img = EGL_NO_IMAGE_KHR;
     unsigned int i;
 
-    if (!surf || !bo) return;
-
-    display = surf->base.dpy;
+    LockSurf(surf);
 
     for (i = 0; i < ARRAY_LEN(surf->images); i++) {
         if (surf->images[i].bo == bo) {
-            surf->images[i].locked = false;
+            EGBM_TRACE3(image_release, surf, (int)i, bo);
+
+            /* Other consumers still hold the frame */
+            if (surf->images[i].lockCount > 1) {
+                surf->images[i].lockCount--;
+                goto done;
+            }
+
+            surf->images[i].lockCount = 0;
             img = surf->images[i].image;
+            RecordSurfEvent(surf, SURF_EVENT_RELEASE, (int)i);
+            PutImageSync(display, surf, &surf->images[i]);
 
             if (!img) {
                 /*
                  * The stream removed this image while it was locked. Free the
                  * buffer object associated with it as well.
                  */
-                gbm_bo_destroy(surf->images[i].bo);
+                DestroySurfImageBo(surf, &surf->images[i]);
             }
 
             break;
@@ -394,49 +923,141 @@ eGbmSurfaceReleaseBuffer(struct gbm_surface* s, struct gbm_bo *bo)
         assert(surf->numFreeImages < WINDOW_STREAM_FIFO_LENGTH);
         surf->numFreeImages++;
     }
+
+done:
+    UnlockSurf(surf);
 }
 
 static void
-FreeSurface(GbmObject* obj)
+SurfaceReleaseBuffer(struct gbm_surface* s, struct gbm_bo *bo)
 {
-    if (obj) {
-        GbmSurface* surf = (GbmSurface*)obj;
-        GbmPlatformData* data = obj->dpy->data;
-        EGLDisplay dpy = obj->dpy->devDpy;
-        unsigned int i;
+    GbmSurface* surf = GetSurf(s);
 
-        for (i = 0; i < ARRAY_LEN(surf->images); i++) {
-            if (surf->images[i].image != EGL_NO_IMAGE_KHR)
-                data->egl.DestroyImageKHR(dpy, surf->images[i].image);
+    if (surf && bo) ReleaseSurfImage(surf, bo);
+}
 
-            if (surf->images[i].bo != NULL)
-                gbm_bo_destroy(surf->images[i].bo);
-        }
+int
+eGbmSurfaceHasFreeBuffers(struct gbm_surface* s)
+{
+    int ret;
 
-        if (surf->egl != EGL_NO_SURFACE)
-            data->egl.DestroySurface(dpy, surf->egl);
-        if (surf->stream != EGL_NO_STREAM_KHR)
-            data->egl.DestroyStreamKHR(dpy, surf->stream);
-        if (surf->sync != EGL_NO_SYNC_KHR)
-            data->egl.DestroySyncKHR(dpy, surf->sync);
+    EGBM_TRACE1(has_free_buffers_entry, s);
+    ret = SurfaceHasFreeBuffers(s);
+    EGBM_TRACE2(has_free_buffers_return, s, ret);
 
-        /* Drop reference to the display acquired at creation time */
-        eGbmUnrefObject(&obj->dpy->base);
+    return ret;
+}
 
-        free(obj);
-    }
+struct gbm_bo*
+eGbmSurfaceLockFrontBuffer(struct gbm_surface* s)
+{
+    struct gbm_bo* bo;
+
+    EGBM_TRACE1(lock_front_buffer_entry, s);
+    bo = SurfaceLockFrontBuffer(s);
+    EGBM_TRACE2(lock_front_buffer_return, s, bo);
+
+    return bo;
 }
 
-EGLSurface
-eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
-                                    EGLConfig config,
-                                    void* nativeWin,
-                                    const EGLAttrib* attribs)
+void
+eGbmSurfaceReleaseBuffer(struct gbm_surface* s, struct gbm_bo *bo)
 {
-    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
-    GbmPlatformData* data;
-    struct gbm_surface* s = nativeWin;
-    GbmSurface* surf = NULL;
+    EGBM_TRACE2(release_buffer_entry, s, bo);
+    SurfaceReleaseBuffer(s, bo);
+    EGBM_TRACE2(release_buffer_return, s, bo);
+}
+
+/* Destroys the driver objects behind <surf> and frees it */
+static void
+TeardownSurface(GbmSurface* surf)
+{
+    GbmDisplay* display = surf->base.dpy;
+    GbmPlatformData* data = display->data;
+    EGLDisplay dpy = display->devDpy;
+    uint64_t start = 0;
+    unsigned int i;
+
+    if (EGBM_TRACE_ENABLED(surface_teardown)) start = eGbmTraceNow();
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        if (surf->images[i].image != EGL_NO_IMAGE_KHR)
+            data->egl.DestroyImageKHR(dpy, surf->images[i].image);
+
+        if (surf->images[i].bo != NULL)
+            gbm_bo_destroy(surf->images[i].bo);
+
+        if (surf->images[i].acquireSync != EGL_NO_SYNC_KHR)
+            data->egl.DestroySyncKHR(dpy, surf->images[i].acquireSync);
+    }
+
+    for (i = 0; i < surf->numPooledSyncs; i++)
+        data->egl.DestroySyncKHR(dpy, surf->syncPool[i]);
+
+    if (surf->egl != EGL_NO_SURFACE)
+        data->egl.DestroySurface(dpy, surf->egl);
+    if (surf->stream != EGL_NO_STREAM_KHR)
+        data->egl.DestroyStreamKHR(dpy, surf->stream);
+    if (surf->sync != EGL_NO_SYNC_KHR)
+        data->egl.DestroySyncKHR(dpy, surf->sync);
+
+    /* The surface's memory goes with it */
+    AddMemory(&display->memory,
+              -(int)surf->memory.numImages, -surf->memory.imageBytes,
+              -(int)surf->memory.numImported, -surf->memory.importedBytes);
+
+    EGBM_TRACE3(surface_teardown, surf, surf->teardown.func != NULL,
+                start ? eGbmTraceNow() - start : 0);
+
+    pthread_mutex_destroy(&surf->mutex);
+    free(surf);
+
+    /*
+     * Drop reference to the display acquired at creation time. This comes
+     * last so that the display outlives all of the surface's driver objects.
+     */
+    eGbmUnrefObject(&display->base);
+}
+
+static void
+TeardownSurfaceWork(GbmWork* work)
+{
+    TeardownSurface((GbmSurface*)((uint8_t*)work -
+                                  offsetof(GbmSurface, teardown)));
+}
+
+static void
+FreeSurface(GbmObject* obj)
+{
+    if (obj) {
+        GbmSurface* surf = (GbmSurface*)obj;
+        GbmPlatformData* data = obj->dpy->data;
+
+        EGBM_STAT_ADD(surfaces, -1);
+
+        /* Nothing can find the surface anymore once it is unlinked */
+        eGbmObjectListRemove(&obj->dpy->objects, obj);
+
+        if (data->asyncDestroy) {
+            surf->teardown.func = TeardownSurfaceWork;
+            if (eGbmWorkerQueue(&data->worker, &surf->teardown)) return;
+            surf->teardown.func = NULL;
+        }
+
+        TeardownSurface(surf);
+    }
+}
+
+EGLSurface
+eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
+                                    EGLConfig config,
+                                    void* nativeWin,
+                                    const EGLAttrib* attribs)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    GbmPlatformData* data;
+    struct gbm_surface* s = nativeWin;
+    GbmSurface* surf = NULL;
     EGLint surfType;
     EGLint err = EGL_BAD_ALLOC;
     EGLBoolean res;
@@ -450,10 +1071,13 @@ eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         EGL_STREAM_FIFO_LENGTH_KHR, WINDOW_STREAM_FIFO_LENGTH,
         EGL_NONE
     };
-    static const EGLint syncAttrs[] = {
-        EGL_SYNC_STATUS_KHR, EGL_SIGNALED_KHR,
-        EGL_NONE
-    };
+    static const EGLuint64KHR linearModifier = DRM_FORMAT_MOD_LINEAR;
+    const EGLuint64KHR* modifiers = s ? s->v0.modifiers : NULL;
+    EGLint numModifiers = s ? s->v0.count : 0;
+    EGLuint64KHR* selected = NULL;
+    GbmScanoutKey scanoutKey;
+    EGLAttrib consumerAttrs[3];
+    unsigned int numConsumerAttrs = 0;
 
     (void)attribs;
 
@@ -489,23 +1113,83 @@ eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         goto fail;
     }
 
+    EGBM_STAT_ADD(surfaces, 1);
+
+    pthread_mutex_init(&surf->mutex, NULL);
     surf->base.dpy = display;
     surf->base.type = EGL_OBJECT_SURFACE_KHR;
     surf->base.refCount = 1;
     surf->base.free = FreeSurface;
     surf->stream = data->egl.CreateStreamKHR(dpy, streamAttrs);
     surf->numFreeImages = WINDOW_STREAM_FIFO_LENGTH;
+    surf->width = s->v0.width;
+    surf->height = s->v0.height;
+    surf->format = s->v0.format;
 
     if (!surf->stream) {
         err = EGL_BAD_ALLOC;
         goto fail;
     }
 
-    if (!data->egl.StreamImageConsumerConnectNV(dpy,
-                                                surf->stream,
-                                                s->v0.count,
-                                                s->v0.modifiers,
-                                                NULL)) {
+    if ((s->v0.flags & GBM_BO_USE_LINEAR) && !s->v0.count) {
+        /*
+         * Only an explicit request constrains the layout. GBM_BO_USE_WRITE
+         * is for gbm_bo_write(), and gbm_bo_map() detiles on its own.
+         */
+        modifiers = &linearModifier;
+        numModifiers = 1;
+    }
+
+    if (s->v0.count) {
+        /* Steer the driver to the fastest layout, see gbm-modifier.h */
+        selected = malloc(s->v0.count * sizeof(*selected));
+
+        if (!selected) {
+            err = EGL_BAD_ALLOC;
+            goto fail;
+        }
+
+        scanoutKey.dev = display->gbmRdev;
+        scanoutKey.format = s->v0.format;
+        scanoutKey.width = s->v0.width;
+        scanoutKey.height = s->v0.height;
+
+        numModifiers =
+            eGbmSelectModifiers((s->v0.flags & GBM_BO_USE_SCANOUT) ?
+                                    &data->scanout : NULL,
+                                &scanoutKey,
+                                s->v0.modifiers,
+                                s->v0.count,
+                                selected);
+        modifiers = selected;
+
+        EGBM_TRACE4(modifier_select, surf, s->v0.count, numModifiers,
+                    numModifiers ? selected[0] : DRM_FORMAT_MOD_INVALID);
+    }
+
+    if ((s->v0.flags & GBM_BO_USE_SCANOUT) &&
+        eGbmHasExtension(
+            display->exts,
+            GBM_EGL_NV_stream_consumer_eglimage_use_scanout_attrib)) {
+        /*
+         * Allocate frames the display engine can flip to, rather than ones
+         * the compositor would have to copy first.
+         */
+        consumerAttrs[numConsumerAttrs++] =
+            EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV;
+        consumerAttrs[numConsumerAttrs++] = EGL_TRUE;
+    }
+
+    consumerAttrs[numConsumerAttrs] = EGL_NONE;
+
+    res = data->egl.StreamImageConsumerConnectNV(dpy,
+                                                 surf->stream,
+                                                 numModifiers,
+                                                 modifiers,
+                                                 consumerAttrs);
+    free(selected);
+
+    if (!res) {
         err = EGL_BAD_ALLOC;
         goto fail;
     }
@@ -528,14 +1212,18 @@ eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
 
     surf->sync = data->egl.CreateSyncKHR(dpy,
                                          EGL_SYNC_FENCE_KHR,
-                                         syncAttrs);
+                                         signaledSyncAttrs);
 
     if (!surf->sync) {
         err = EGL_BAD_ALLOC;
         goto fail;
     }
 
-    if (!PumpSurfEvents(display, surf)) {
+    LockSurf(surf);
+    res = PumpSurfEvents(display, surf);
+    UnlockSurf(surf);
+
+    if (!res) {
         err = EGL_BAD_ALLOC;
         goto fail;
     }
@@ -546,8 +1234,11 @@ eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         goto fail;
     }
 
+    surf->native = s;
     SetSurf(s, surf);
 
+    eGbmObjectListAdd(&display->objects, &surf->base);
+
     return (EGLSurface)surf;
 
 fail:
@@ -564,17 +1255,783 @@ eGbmSurfaceUnwrap(GbmObject* obj)
     return ((GbmSurface*)obj)->egl;
 }
 
+/*
+ * Detaches <surf> from its gbm_surface when its handle is destroyed. The
+ * surface may outlive its handle, see egl_gbm_surface_read_front_buffer(),
+ * but gbm calls on the gbm_surface must stop finding it: it is torn down
+ * along with any frames still locked without further notice.
+ */
+static void
+DetachSurface(GbmSurface* surf)
+{
+    LockSurf(surf);
+
+    if (surf->native && GetSurf(surf->native) == surf)
+        SetSurf(surf->native, NULL);
+
+    surf->native = NULL;
+
+    UnlockSurf(surf);
+}
+
+void
+eGbmSurfacesTerminate(GbmDisplay* display)
+{
+    GbmObject* obj;
+
+    pthread_mutex_lock(&display->objects.mutex);
+
+    for (obj = display->objects.first; obj; obj = obj->listNext) {
+        if (obj->type == EGL_OBJECT_SURFACE_KHR)
+            DetachSurface((GbmSurface*)obj);
+    }
+
+    pthread_mutex_unlock(&display->objects.mutex);
+}
+
 EGLBoolean
 eGbmDestroySurfaceHook(EGLDisplay dpy, EGLSurface eglSurf)
 {
     GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    GbmSurface* surf;
     EGLBoolean ret = EGL_FALSE;
 
     if (!display) return ret;
 
-    if (eGbmDestroyHandle(eglSurf)) ret = EGL_TRUE;
+    surf = (GbmSurface*)eGbmRefHandle(eglSurf);
+
+    if (surf) {
+        if (surf->base.type == EGL_OBJECT_SURFACE_KHR) DetachSurface(surf);
+
+        if (eGbmDestroyHandle(eglSurf)) ret = EGL_TRUE;
+
+        eGbmUnrefObject(&surf->base);
+    }
 
     eGbmUnrefObject(&display->base);
 
     return ret;
 }
+
+EGBM_EXPORT int
+egl_gbm_surfaces_lock_front_buffers(struct gbm_surface* const* surfaces,
+                                    unsigned int count,
+                                    uint32_t flags,
+                                    struct gbm_bo** bos)
+{
+    GbmSurface* surf;
+    unsigned int i;
+    int locked = 0;
+
+    if (count && (!surfaces || !bos)) return -EINVAL;
+
+    if (flags & ~EGL_GBM_LOCK_LATEST_FRAME) return -EINVAL;
+
+    EGBM_TRACE1(lock_front_buffers_entry, count);
+
+    for (i = 0; i < count; i++) {
+        bos[i] = NULL;
+
+        if (!(surf = GetSurf(surfaces[i]))) continue;
+
+        LockSurf(surf);
+
+        if (PumpSurfEvents(surf->base.dpy, surf)) {
+            if (flags & EGL_GBM_LOCK_LATEST_FRAME) DropStaleFrames(surf);
+            bos[i] = LockSurfImage(surfaces[i], surf);
+        }
+
+        UnlockSurf(surf);
+
+        if (bos[i]) locked++;
+    }
+
+    EGBM_TRACE2(lock_front_buffers_return, count, locked);
+
+    return locked;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_get_memory_info(struct gbm_surface* s,
+                                struct egl_gbm_memory_info* info)
+{
+    GbmSurface* surf = GetSurf(s);
+
+    if (!surf || !info) return -EINVAL;
+
+    eGbmReadMemoryCounters(&surf->memory, info);
+    info->num_surfaces = 1;
+
+    return 0;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_get_acquire_sync(struct gbm_surface* s,
+                                 struct gbm_bo* bo,
+                                 EGLSyncKHR* sync)
+{
+    GbmSurface* surf = GetSurf(s);
+    int ret = -EINVAL;
+    unsigned int i;
+
+    if (!surf || !bo || !sync) return -EINVAL;
+
+    LockSurf(surf);
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        if (surf->images[i].bo == bo && surf->images[i].lockCount) {
+            *sync = surf->images[i].acquireSync;
+            ret = 0;
+            break;
+        }
+    }
+
+    UnlockSurf(surf);
+
+    return ret;
+}
+
+/*
+ * Takes another lock on <bo> if it is currently locked from <surf>, and
+ * returns its image. Called with the surface locked.
+ */
+static GbmSurfaceImage*
+AddSurfImageLock(GbmSurface* surf, struct gbm_bo* bo)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        GbmSurfaceImage* image = &surf->images[i];
+
+        if (image->bo == bo && image->lockCount) {
+            image->lockCount++;
+            EGBM_TRACE3(image_add_lock, surf, (int)i, image->lockCount);
+            return image;
+        }
+    }
+
+    return NULL;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_add_front_buffer_lock(struct gbm_surface* s,
+                                      struct gbm_bo* bo)
+{
+    GbmSurface* surf = GetSurf(s);
+    int ret = -EINVAL;
+
+    if (!surf || !bo) return -EINVAL;
+
+    LockSurf(surf);
+
+    if (AddSurfImageLock(surf, bo)) ret = 0;
+
+    UnlockSurf(surf);
+
+    return ret;
+}
+
+/*
+ * Runs on the readback worker, concurrently with the compositor's calls on
+ * the surface. Only WaitSurfSync() and ReleaseSurfImage() touch the surface
+ * state here, and both take the surface lock.
+ */
+static void
+ReadbackWork(GbmWork* work)
+{
+    GbmReadback* rb = (GbmReadback*)work;
+    GbmSurface* surf = rb->surf;
+    uint32_t height = gbm_bo_get_height(rb->bo);
+    uint32_t srcStride;
+    void* mapData = NULL;
+    const uint8_t* src;
+    uint64_t start = 0;
+    int status = 0;
+    uint32_t y;
+
+    if (EGBM_TRACE_ENABLED(readback)) start = eGbmTraceNow();
+
+    if (rb->sync != EGL_NO_SYNC_KHR &&
+        !WaitSurfSync(surf, rb->sync, rb->slot, "readback", false)) {
+        status = -EIO;
+        goto done;
+    }
+
+    /* The backend detiles the buffer into a linear mapping */
+    src = gbm_bo_map(rb->bo, 0, 0, gbm_bo_get_width(rb->bo), height,
+                     GBM_BO_TRANSFER_READ, &srcStride, &mapData);
+
+    if (!src) {
+        status = -EIO;
+        goto done;
+    }
+
+    for (y = 0; y < height; y++) {
+        memcpy((uint8_t*)rb->dst + (size_t)y * rb->dstStride,
+               src + (size_t)y * srcStride, rb->rowBytes);
+    }
+
+    gbm_bo_unmap(rb->bo, mapData);
+
+done:
+    EGBM_TRACE4(readback, surf, rb->bo, status,
+                start ? eGbmTraceNow() - start : 0);
+
+    rb->callback(rb->bo, status, rb->callbackData);
+
+    ReleaseSurfImage(surf, rb->bo);
+    eGbmUnrefObject(&surf->base);
+    free(rb);
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_read_front_buffer(struct gbm_surface* s,
+                                  struct gbm_bo* bo,
+                                  void* dst,
+                                  uint32_t dst_stride,
+                                  egl_gbm_readback_callback callback,
+                                  void* data)
+{
+    GbmSurface* surf = GetSurf(s);
+    GbmSurfaceImage* image;
+    GbmReadback* rb;
+    int ret = -EINVAL;
+
+    if (!surf || !bo || !dst || !callback) return -EINVAL;
+
+    if (!(rb = calloc(1, sizeof(*rb)))) return -ENOMEM;
+
+    /* Keeps the surface alive past eglDestroySurface until the copy is done */
+    if (!eGbmRefHandle(&surf->base)) {
+        free(rb);
+        return -EINVAL;
+    }
+
+    LockSurf(surf);
+    image = AddSurfImageLock(surf, bo);
+    if (image) {
+        rb->sync = image->acquireSync;
+        rb->slot = image - surf->images;
+    }
+    UnlockSurf(surf);
+
+    if (!image) goto fail;
+
+    /* <bo> is known to be ours now */
+    rb->rowBytes = gbm_bo_get_width(bo) * ((gbm_bo_get_bpp(bo) + 7) / 8);
+
+    if (!rb->rowBytes || dst_stride < rb->rowBytes) goto fail_locked;
+
+    rb->work.func = ReadbackWork;
+    rb->surf = surf;
+    rb->bo = bo;
+    rb->dst = dst;
+    rb->dstStride = dst_stride;
+    rb->callback = callback;
+    rb->callbackData = data;
+
+    if (eGbmWorkerQueue(&surf->base.dpy->data->readbackWorker, &rb->work))
+        return 0;
+
+    ret = -EAGAIN;
+
+fail_locked:
+    ReleaseSurfImage(surf, bo);
+
+fail:
+    eGbmUnrefObject(&surf->base);
+    free(rb);
+
+    return ret;
+}
+
+/*
+ * Checks the result <sent> of sending a <size>-byte export message. The
+ * socket keeps message boundaries, so a short write can't be completed by
+ * sending the rest, and is reported as -EIO.
+ */
+static int
+CheckExportSend(ssize_t sent, size_t size)
+{
+    if (sent < 0) return -errno;
+
+    return (size_t)sent == size ? 0 : -EIO;
+}
+
+/* Sends the layout and plane fds of <bo>, the buffer of image <slot> */
+static int
+SendExportBuffer(int sock, uint32_t slot, struct gbm_bo* bo)
+{
+    struct egl_gbm_export_buffer msg;
+    int fds[GBM_MAX_PLANES];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { &msg, sizeof(msg) };
+    struct msghdr hdr;
+    struct cmsghdr* cmsg;
+    ssize_t sent;
+    int planes = gbm_bo_get_plane_count(bo);
+    int numFds = 0;
+    int ret = 0;
+    int i;
+
+    if (planes < 1 || planes > GBM_MAX_PLANES) return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = EGL_GBM_EXPORT_BUFFER;
+    msg.slot = slot;
+    msg.width = gbm_bo_get_width(bo);
+    msg.height = gbm_bo_get_height(bo);
+    msg.format = gbm_bo_get_format(bo);
+    msg.num_planes = planes;
+    msg.modifier = gbm_bo_get_modifier(bo);
+
+    for (i = 0; i < planes; i++) {
+        fds[i] = gbm_bo_get_fd_for_plane(bo, i);
+
+        if (fds[i] < 0) {
+            ret = -EIO;
+            goto done;
+        }
+
+        numFds++;
+        msg.strides[i] = gbm_bo_get_stride_for_plane(bo, i);
+        msg.offsets[i] = gbm_bo_get_offset(bo, i);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(control, 0, sizeof(control));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, numFds * sizeof(int));
+
+    do {
+        sent = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    ret = CheckExportSend(sent, sizeof(msg));
+
+done:
+    /* The receiver gets its own references */
+    for (i = 0; i < numFds; i++) close(fds[i]);
+
+    return ret;
+}
+
+/* Drops one export lock on image <slot>. Returns false if it holds none */
+static bool
+ReleaseExport(GbmSurface* surf, uint32_t slot)
+{
+    struct gbm_bo* bo = NULL;
+
+    LockSurf(surf);
+
+    if (slot < ARRAY_LEN(surf->images) && surf->images[slot].exportLocks) {
+        surf->images[slot].exportLocks--;
+        bo = surf->images[slot].bo;
+    }
+
+    UnlockSurf(surf);
+
+    if (!bo) return false;
+
+    EGBM_TRACE2(export_release, surf, (int)slot);
+    ReleaseSurfImage(surf, bo);
+
+    return true;
+}
+
+/*
+ * Forgets the export socket after the receiver went away or misbehaved,
+ * releasing the frames it still held.
+ */
+static void
+DropExports(GbmSurface* surf)
+{
+    struct gbm_bo* bos[MAX_STREAM_IMAGES];
+    unsigned int locks[MAX_STREAM_IMAGES];
+    unsigned int i;
+
+    LockSurf(surf);
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        bos[i] = surf->images[i].bo;
+        locks[i] = surf->images[i].exportLocks;
+        surf->images[i].exportLocks = 0;
+        surf->images[i].exported = false;
+    }
+
+    surf->exporting = false;
+
+    UnlockSurf(surf);
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        while (locks[i]--) ReleaseSurfImage(surf, bos[i]);
+    }
+}
+
+/* Whether <sock> is the socket <surf> exports over. Called with it locked */
+static bool
+IsExportSocket(GbmSurface* surf, const struct stat* sock)
+{
+    return surf->exporting &&
+           sock->st_dev == surf->exportDev &&
+           sock->st_ino == surf->exportIno;
+}
+
+/*
+ * Duplicates the fence <sync> of image <slot> as a sync_file fd the receiver
+ * can wait on. If the driver can't, waits for it on the CPU instead, and
+ * returns -1. Returns -2 if that wait failed.
+ */
+static int
+GetExportFence(GbmSurface* surf, EGLSyncKHR sync, uint32_t slot)
+{
+    GbmDisplay* display = surf->base.dpy;
+    GbmPlatformData* data = display->data;
+    int fence;
+
+    if (sync == EGL_NO_SYNC_KHR) return -1;
+
+    if (eGbmHasExtension(display->exts, GBM_EGL_ANDROID_native_fence_sync) &&
+        data->egl.DupNativeFenceFDANDROID) {
+        fence = data->egl.DupNativeFenceFDANDROID(display->devDpy, sync);
+
+        if (fence >= 0) return fence;
+    }
+
+    return WaitSurfSync(surf, sync, (int)slot, "export", false) ? -1 : -2;
+}
+
+/* Sends the frame message <frame>, with <fence> as SCM_RIGHTS if not -1 */
+static int
+SendExportFrame(int sock, struct egl_gbm_export_frame* frame, int fence)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { frame, sizeof(*frame) };
+    struct msghdr hdr;
+    struct cmsghdr* cmsg;
+    ssize_t sent;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    if (fence >= 0) {
+        frame->flags |= EGL_GBM_EXPORT_FRAME_FENCE;
+
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fence, sizeof(int));
+    }
+
+    do {
+        sent = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    return CheckExportSend(sent, sizeof(*frame));
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_export_front_buffer(struct gbm_surface* s,
+                                    struct gbm_bo* bo,
+                                    int fd)
+{
+    GbmSurface* surf = GetSurf(s);
+    GbmSurfaceImage* image = NULL;
+    struct egl_gbm_export_frame frame;
+    struct stat sock;
+    EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+    bool sendBuffer = false;
+    unsigned int i;
+    int fence = -1;
+    int ret = -EINVAL;
+
+    if (!surf || !bo || fd < 0) return -EINVAL;
+
+    if (fstat(fd, &sock)) return -errno;
+
+    if (!S_ISSOCK(sock.st_mode)) return -ENOTSOCK;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = EGL_GBM_EXPORT_FRAME;
+
+    LockSurf(surf);
+
+    if (!IsExportSocket(surf, &sock)) {
+        /* Frames exported over the previous socket must come back first */
+        for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+            if (surf->images[i].exportLocks) {
+                ret = -EBUSY;
+                goto unlock;
+            }
+        }
+
+        for (i = 0; i < ARRAY_LEN(surf->images); i++)
+            surf->images[i].exported = false;
+
+        surf->exporting = true;
+        surf->exportDev = sock.st_dev;
+        surf->exportIno = sock.st_ino;
+    }
+
+    if ((image = AddSurfImageLock(surf, bo))) {
+        image->exportLocks++;
+        frame.slot = image - surf->images;
+        frame.sequence = ++surf->exportSeq;
+        sendBuffer = !image->exported;
+        image->exported = true;
+        sync = image->acquireSync;
+    }
+
+unlock:
+    UnlockSurf(surf);
+
+    if (!image) return ret;
+
+    /*
+     * The receiver may read the frame as soon as it gets the message, unless
+     * it comes with a fence to wait on first
+     */
+    if ((fence = GetExportFence(surf, sync, frame.slot)) == -2) {
+        ret = -EIO;
+        goto fail;
+    }
+
+    if (sendBuffer && (ret = SendExportBuffer(fd, frame.slot, bo))) goto fail;
+
+    if ((ret = SendExportFrame(fd, &frame, fence))) goto fail;
+
+    if (fence >= 0) close(fence);
+
+    EGBM_TRACE4(frame_export, surf, (int)frame.slot, frame.sequence,
+                sendBuffer);
+
+    return 0;
+
+fail:
+    if (fence >= 0) close(fence);
+
+    LockSurf(surf);
+    if (sendBuffer) image->exported = false;
+    UnlockSurf(surf);
+
+    ReleaseExport(surf, frame.slot);
+
+    return ret;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_dispatch_export(struct gbm_surface* s, int fd)
+{
+    GbmSurface* surf = GetSurf(s);
+    struct egl_gbm_export_frame msg;
+    struct stat sock;
+    ssize_t len;
+    bool exporting;
+    int count = 0;
+
+    if (!surf || fd < 0) return -EINVAL;
+
+    if (fstat(fd, &sock)) return -errno;
+
+    LockSurf(surf);
+    exporting = IsExportSocket(surf, &sock);
+    UnlockSurf(surf);
+
+    if (!exporting) return -EINVAL;
+
+    for (;;) {
+        len = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT);
+
+        if (len < 0 && errno == EINTR) continue;
+
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        if (len < 0) {
+            int err = errno;
+
+            DropExports(surf);
+            return -err;
+        }
+
+        if (len == 0) {
+            DropExports(surf);
+            return -EPIPE;
+        }
+
+        if (len != sizeof(msg) || msg.type != EGL_GBM_EXPORT_RELEASE ||
+            !ReleaseExport(surf, msg.slot)) {
+            DropExports(surf);
+            return -EPROTO;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_lock_front_buffer_before(struct gbm_surface* s,
+                                         uint64_t deadline_ns,
+                                         struct gbm_bo** bo,
+                                         uint64_t* present_ns)
+{
+    GbmSurface* surf = GetSurf(s);
+    GbmSurfaceImage* image;
+
+    if (!surf || !bo) return -EINVAL;
+
+    *bo = NULL;
+
+    LockSurf(surf);
+
+    if (PumpSurfEvents(surf->base.dpy, surf) &&
+        DropFramesBefore(surf, deadline_ns)) {
+        image = surf->acquiredImages.first;
+        *bo = LockSurfImage(s, surf);
+
+        if (*bo && present_ns) *present_ns = image->presentNs;
+    }
+
+    UnlockSurf(surf);
+
+    return 0;
+}
+
+EGBM_EXPORT int
+egl_gbm_surface_report_scanout(struct gbm_surface* s,
+                               struct gbm_bo* bo,
+                               int accepted)
+{
+    GbmSurface* surf = GetSurf(s);
+    GbmScanoutKey key;
+    uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+    unsigned int i;
+
+    if (!surf || !bo) return -EINVAL;
+
+    LockSurf(surf);
+
+    for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+        if (surf->images[i].bo == bo) {
+            modifier = gbm_bo_get_modifier(bo);
+            break;
+        }
+    }
+
+    UnlockSurf(surf);
+
+    if (modifier == DRM_FORMAT_MOD_INVALID) return -EINVAL;
+
+    key.dev = surf->base.dpy->gbmRdev;
+    key.format = surf->format;
+    key.width = surf->width;
+    key.height = surf->height;
+
+    eGbmScanoutCacheReport(&surf->base.dpy->data->scanout, &key, modifier,
+                           accepted != 0);
+    EGBM_TRACE3(scanout_report, surf, modifier, accepted != 0);
+
+    return 0;
+}
+
+EGLBoolean
+eGbmPresentationTimeHook(EGLDisplay dpy,
+                         EGLSurface eglSurf,
+                         EGLnsecsANDROID time)
+{
+    GbmDisplay* display = (GbmDisplay*)eGbmRefHandle(dpy);
+    GbmObject* obj = NULL;
+    GbmSurface* surf;
+    EGLuint64KHR produced;
+    EGLBoolean ret = EGL_FALSE;
+    unsigned int i;
+
+    if (!display) {
+        /*  No platform data. Can't set error EGL_NO_DISPLAY */
+        return EGL_FALSE;
+    }
+
+    obj = eglSurf ? eGbmRefHandle(eglSurf) : NULL;
+
+    if (!obj || obj->type != EGL_OBJECT_SURFACE_KHR || obj->dpy != display) {
+        eGbmSetError(display->data, EGL_BAD_SURFACE);
+        goto done;
+    }
+
+    surf = (GbmSurface*)obj;
+
+    if (!display->data->egl.QueryStreamu64KHR ||
+        !display->data->egl.QueryStreamu64KHR(display->devDpy, surf->stream,
+                                              EGL_PRODUCER_FRAME_KHR,
+                                              &produced)) {
+        eGbmSetError(display->data, EGL_BAD_SURFACE);
+        goto done;
+    }
+
+    /* The time applies to the frame the next eglSwapBuffers produces */
+    LockSurf(surf);
+    i = (produced + 1) % ARRAY_LEN(surf->presentTimes);
+    surf->presentTimes[i].frame = produced + 1;
+    surf->presentTimes[i].timeNs = time > 0 ? (uint64_t)time : 0;
+    UnlockSurf(surf);
+
+    EGBM_TRACE3(present_time, surf, produced + 1, time);
+    ret = EGL_TRUE;
+
+done:
+    if (obj) eGbmUnrefObject(obj);
+    eGbmUnrefObject(&display->base);
+
+    return ret;
+}
+
+void
+eGbmSurfaceDumpAll(GbmDisplay* display, int fd)
+{
+    struct egl_gbm_memory_info info;
+    GbmObject* obj;
+    unsigned int i;
+
+    pthread_mutex_lock(&display->objects.mutex);
+
+    for (obj = display->objects.first; obj; obj = obj->listNext) {
+        GbmSurface* surf = (GbmSurface*)obj;
+
+        if (obj->type != EGL_OBJECT_SURFACE_KHR) continue;
+
+        eGbmReadMemoryCounters(&surf->memory, &info);
+
+        dprintf(fd, "  surface %p: %ux%u %.4s, %u images (%" PRIu64
+                " bytes), %u imported (%" PRIu64 " bytes)\n",
+                (void*)surf, surf->width, surf->height,
+                (const char*)&surf->format,
+                info.num_images, info.image_bytes,
+                info.num_imported, info.imported_bytes);
+
+        for (i = 0; i < ARRAY_LEN(surf->images); i++) {
+            const GbmSurfaceImage* image = &surf->images[i];
+            uint64_t size = __atomic_load_n(&image->size, __ATOMIC_RELAXED);
+
+            if (!size) continue;
+
+            dprintf(fd, "    image %u: %" PRIu64 " bytes\n", i, size);
+        }
+    }
+
+    pthread_mutex_unlock(&display->objects.mutex);
+}
@@ -8,8 +8,10 @@
 #define GBM_SURFACE_H
 
 #include "gbm-handle.h"
+#include "gbm-platform.h"
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <gbm.h>
 
 int eGbmSurfaceHasFreeBuffers(struct gbm_surface* s);
@@ -22,5 +24,16 @@ EGLSurface eGbmCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
 void* eGbmSurfaceUnwrap(GbmObject* obj);
 EGLBoolean
 eGbmDestroySurfaceHook(EGLDisplay dpy, EGLSurface eglSurf);
+EGLBoolean eGbmPresentationTimeHook(EGLDisplay dpy,
+                                    EGLSurface eglSurf,
+                                    EGLnsecsANDROID time);
+/*
+ * Detaches every window surface of <display> from its gbm_surface, before
+ * eglTerminate destroys their handles. Takes display->objects.mutex.
+ */
+void eGbmSurfacesTerminate(struct GbmDisplayRec* display);
+
+/* Describes every window surface of <display>. Takes display->objects.mutex */
+void eGbmSurfaceDumpAll(struct GbmDisplayRec* display, int fd);
 
 #endif /* GBM_SURFACE_H */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Static tracepoints in the egl_gbm provider. Arguments are listed after each
+ * probe name. Durations are in nanoseconds and are only measured while a
+ * tracer is attached to the probe.
+ */
+
+/* EGL hooks: dpy [, return value] */
+DO_TRACE_PROBE(choose_config_entry)                     /* dpy */
+DO_TRACE_PROBE(choose_config_return)                    /* dpy, ret, numConfig */
+DO_TRACE_PROBE(create_image_entry)                      /* dpy, target, buffer */
+DO_TRACE_PROBE(create_image_return)                     /* dpy, image */
+DO_TRACE_PROBE(create_pbuffer_surface_entry)            /* dpy, config */
+DO_TRACE_PROBE(create_pbuffer_surface_return)           /* dpy, surface */
+DO_TRACE_PROBE(create_platform_pixmap_surface_entry)    /* dpy, config */
+DO_TRACE_PROBE(create_platform_pixmap_surface_return)   /* dpy, surface */
+DO_TRACE_PROBE(create_platform_window_surface_entry)    /* dpy, config, gbm_surface */
+DO_TRACE_PROBE(create_platform_window_surface_return)   /* dpy, surface */
+DO_TRACE_PROBE(destroy_image_entry)                     /* dpy, image */
+DO_TRACE_PROBE(destroy_image_return)                    /* dpy, image, ret */
+DO_TRACE_PROBE(destroy_surface_entry)                   /* dpy, surface */
+DO_TRACE_PROBE(destroy_surface_return)                  /* dpy, surface, ret */
+DO_TRACE_PROBE(get_config_attrib_entry)                 /* dpy, config, attribute */
+DO_TRACE_PROBE(get_config_attrib_return)                /* dpy, ret, value */
+DO_TRACE_PROBE(initialize_entry)                        /* dpy */
+DO_TRACE_PROBE(initialize_return)                       /* dpy, ret */
+DO_TRACE_PROBE(presentation_time_entry)                 /* dpy, surface, time */
+DO_TRACE_PROBE(presentation_time_return)                /* dpy, surface, ret */
+DO_TRACE_PROBE(query_display_attrib_entry)              /* dpy, name */
+DO_TRACE_PROBE(query_display_attrib_return)             /* dpy, ret, value */
+DO_TRACE_PROBE(terminate_entry)                         /* dpy */
+DO_TRACE_PROBE(terminate_return)                        /* dpy, ret */
+
+/* Platform exports */
+DO_TRACE_PROBE(get_hook_address)                        /* name, func */
+DO_TRACE_PROBE(get_internal_handle_entry)               /* dpy, type, handle */
+DO_TRACE_PROBE(get_internal_handle_return)              /* dpy, result */
+DO_TRACE_PROBE(get_platform_display_entry)              /* platform, nativeDpy */
+DO_TRACE_PROBE(get_platform_display_return)             /* nativeDpy, dpy */
+DO_TRACE_PROBE(is_valid_native_display_entry)           /* nativeDpy */
+DO_TRACE_PROBE(is_valid_native_display_return)          /* nativeDpy, ret */
+DO_TRACE_PROBE(query_string_entry)                      /* dpy, name */
+DO_TRACE_PROBE(query_string_return)                     /* dpy, string */
+DO_TRACE_PROBE(unload_platform)                         /* data */
+
+/* gbm surface operations */
+DO_TRACE_PROBE(has_free_buffers_entry)                  /* gbm_surface */
+DO_TRACE_PROBE(has_free_buffers_return)                 /* gbm_surface, ret */
+DO_TRACE_PROBE(lock_front_buffer_entry)                 /* gbm_surface */
+DO_TRACE_PROBE(lock_front_buffer_return)                /* gbm_surface, bo */
+DO_TRACE_PROBE(release_buffer_entry)                    /* gbm_surface, bo */
+DO_TRACE_PROBE(release_buffer_return)                   /* gbm_surface, bo */
+DO_TRACE_PROBE(lock_front_buffers_entry)                /* count */
+DO_TRACE_PROBE(lock_front_buffers_return)               /* count, locked */
+DO_TRACE_PROBE(pump_events_entry)                       /* surface */
+DO_TRACE_PROBE(pump_events_return)                      /* surface, ok */
+DO_TRACE_PROBE(stream_event)                            /* surface, event, aux */
+DO_TRACE_PROBE(image_acquire)                           /* surface, slot, waitNs, ok */
+DO_TRACE_PROBE(image_lock)                              /* surface, slot, bo */
+DO_TRACE_PROBE(image_add_lock)                          /* surface, slot, lockCount */
+DO_TRACE_PROBE(image_release)                           /* surface, slot, bo */
+DO_TRACE_PROBE(bo_import)                               /* surface, slot, bo, durationNs */
+DO_TRACE_PROBE(surface_teardown)                        /* surface, deferred, durationNs */
+DO_TRACE_PROBE(readback)                                /* surface, bo, status, durationNs */
+DO_TRACE_PROBE(frame_export)                            /* surface, slot, sequence, sentBuffer */
+DO_TRACE_PROBE(export_release)                          /* surface, slot */
+DO_TRACE_PROBE(present_time)                            /* surface, frame, timeNs */
+DO_TRACE_PROBE(modifier_select)                         /* surface, numOffered, numSelected, first */
+DO_TRACE_PROBE(scanout_report)                          /* surface, modifier, accepted */
+DO_TRACE_PROBE(wait_stall)                              /* surface, slot, waitedNs, gaveUp */
+
+/* Cached EGLImages */
+DO_TRACE_PROBE(bo_image)                                /* bo, image, cacheHit */
+DO_TRACE_PROBE(dma_buf_image)                           /* image, cacheHit, numIdle */
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-trace.h"
+
+#if defined(HAVE_SYS_SDT_H)
+/*
+ * Probe semaphores. Tracers increment these in the .probes section while
+ * attached to the corresponding probe.
+ */
+#define DO_TRACE_PROBE(_NAME) \
+    unsigned short egl_gbm_##_NAME##_semaphore \
+        __attribute__((section(".probes")));
+#include "gbm-trace-probes.h"
+#undef DO_TRACE_PROBE
+#endif /* defined(HAVE_SYS_SDT_H) */
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_TRACE_H
+#define GBM_TRACE_H
+
+#include "gbm-record.h"
+#include "gbm-utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * When built with <sys/sdt.h>, the EGBM_TRACE* macros are USDT probes in the
+ * "egl_gbm" provider, listed in gbm-trace-probes.h. Each compiles to a single
+ * nop until a tracer such as perf or bpftrace attaches to it. Without
+ * <sys/sdt.h> the probes compile to nothing.
+ *
+ * Every probe has a semaphore, so code that has to do extra work to produce a
+ * probe argument, such as timing a wait, can skip it with
+ * EGBM_TRACE_ENABLED() while nothing is attached.
+ *
+ * Independently of USDT, every tracepoint also feeds the call recorder in
+ * gbm-record.h while it is enabled.
+ */
+
+#define EGBM_RECORD_ARG(_A) ((int64_t)(intptr_t)(_A))
+
+#define EGBM_RECORD(_NAME, ...)                                         \
+    do {                                                                \
+        if (__builtin_expect(eGbmRecording, 0)) {                       \
+            const int64_t _recordArgs[] = { __VA_ARGS__ };              \
+            eGbmRecordEvent(GBM_RECORD_OP_##_NAME,                      \
+                            sizeof(_recordArgs) / sizeof(int64_t),      \
+                            _recordArgs);                               \
+        }                                                               \
+    } while (0)
+
+#if defined(HAVE_SYS_SDT_H)
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define DO_TRACE_PROBE(_NAME) extern unsigned short egl_gbm_##_NAME##_semaphore;
+#include "gbm-trace-probes.h"
+#undef DO_TRACE_PROBE
+
+#define EGBM_TRACE_ENABLED(_NAME) \
+    __builtin_expect(egl_gbm_##_NAME##_semaphore != 0 || eGbmRecording, 0)
+
+#define EGBM_PROBE1(_NAME, _A) \
+    DTRACE_PROBE1(egl_gbm, _NAME, _A)
+#define EGBM_PROBE2(_NAME, _A, _B) \
+    DTRACE_PROBE2(egl_gbm, _NAME, _A, _B)
+#define EGBM_PROBE3(_NAME, _A, _B, _C) \
+    DTRACE_PROBE3(egl_gbm, _NAME, _A, _B, _C)
+#define EGBM_PROBE4(_NAME, _A, _B, _C, _D) \
+    DTRACE_PROBE4(egl_gbm, _NAME, _A, _B, _C, _D)
+
+#else /* defined(HAVE_SYS_SDT_H) */
+
+#define EGBM_TRACE_ENABLED(_NAME) __builtin_expect(eGbmRecording, 0)
+
+#define EGBM_PROBE1(_NAME, _A) do { } while (0)
+#define EGBM_PROBE2(_NAME, _A, _B) do { } while (0)
+#define EGBM_PROBE3(_NAME, _A, _B, _C) do { } while (0)
+#define EGBM_PROBE4(_NAME, _A, _B, _C, _D) do { } while (0)
+
+#endif /* defined(HAVE_SYS_SDT_H) */
+
+#define EGBM_TRACE1(_NAME, _A)                                          \
+    do {                                                                \
+        EGBM_PROBE1(_NAME, _A);                                         \
+        EGBM_RECORD(_NAME, EGBM_RECORD_ARG(_A));                        \
+    } while (0)
+#define EGBM_TRACE2(_NAME, _A, _B)                                      \
+    do {                                                                \
+        EGBM_PROBE2(_NAME, _A, _B);                                     \
+        EGBM_RECORD(_NAME, EGBM_RECORD_ARG(_A), EGBM_RECORD_ARG(_B));   \
+    } while (0)
+#define EGBM_TRACE3(_NAME, _A, _B, _C)                                  \
+    do {                                                                \
+        EGBM_PROBE3(_NAME, _A, _B, _C);                                 \
+        EGBM_RECORD(_NAME, EGBM_RECORD_ARG(_A), EGBM_RECORD_ARG(_B),    \
+                    EGBM_RECORD_ARG(_C));                               \
+    } while (0)
+#define EGBM_TRACE4(_NAME, _A, _B, _C, _D)                              \
+    do {                                                                \
+        EGBM_PROBE4(_NAME, _A, _B, _C, _D);                             \
+        EGBM_RECORD(_NAME, EGBM_RECORD_ARG(_A), EGBM_RECORD_ARG(_B),    \
+                    EGBM_RECORD_ARG(_C), EGBM_RECORD_ARG(_D));          \
+    } while (0)
+
+/* CLOCK_MONOTONIC in nanoseconds */
+static inline uint64_t
+eGbmTraceNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* GBM_TRACE_H */
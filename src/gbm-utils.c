@@ -5,37 +5,112 @@
  */
 
 #include "gbm-utils.h"
+#include "gbm-stats.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 #if HAS_MINCORE
 #include <unistd.h>
 #include <dlfcn.h>
 #endif
 
-EGLBoolean
-eGbmFindExtension(const char* extension, const char* extensions)
+typedef struct GbmExtensionNameRec {
+    const char* name;
+    size_t len;
+} GbmExtensionName;
+
+static const GbmExtensionName ExtensionNames[] = {
+#define DO_EGL_EXT(_EXT) { #_EXT, sizeof(#_EXT) - 1 },
+#include "gbm-egl-extensions.h"
+#undef DO_EGL_EXT
+};
+
+/*
+ * Bit N is set if some name in <ExtensionNames> is N characters long, with
+ * longer names counted as 63. Most tokens in a driver's extension string can
+ * be skipped on their length alone, without a table lookup.
+ */
+#define NAME_LEN_BIT(_len) (1ULL << ((_len) < 63 ? (_len) : 63))
+
+static const uint64_t ExtensionNameLens = 0
+#define DO_EGL_EXT(_EXT) | NAME_LEN_BIT(sizeof(#_EXT) - 1)
+#include "gbm-egl-extensions.h"
+#undef DO_EGL_EXT
+    ;
+
+/*
+ * Returns the index of the <len> characters at <name> in <ExtensionNames>, or
+ * -1 if they aren't listed there.
+ */
+static int
+FindExtension(const char* name, size_t len)
 {
-    const char* start;
-    const char* where;
-    const char* terminator;
-
-    start = extensions;
-    for (;;) {
-        where = strstr(start, extension);
-        if (!where) {
-            break;
-        }
-        terminator = where + strlen(extension);
-        if (where == start || *(where - 1) == ' ') {
-            if (*terminator == ' ' || *terminator == '\0') {
-                return EGL_TRUE;
-            }
-        }
-        start = terminator;
+    size_t lo = 0, hi = ARRAY_LEN(ExtensionNames);
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const GbmExtensionName* ext = &ExtensionNames[mid];
+        int res = memcmp(name, ext->name, len < ext->len ? len : ext->len);
+
+        /* One is a prefix of the other, or they are equal */
+        if (!res) res = (len > ext->len) - (len < ext->len);
+
+        if (!res) return mid;
+
+        if (res < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
 
-    return EGL_FALSE;
+    return -1;
+}
+
+GbmExtensionSet
+eGbmParseExtensions(const char* extensions)
+{
+    GbmExtensionSet set = 0;
+    const char* p = extensions;
+    const char* name;
+    size_t len;
+    int ext;
+
+    if (!p) return 0;
+
+    while (*p) {
+        while (*p == ' ') p++;
+
+        name = p;
+        p = strchrnul(p, ' ');
+        len = p - name;
+
+        if (!len || !(ExtensionNameLens & NAME_LEN_BIT(len))) continue;
+
+        ext = FindExtension(name, len);
+
+        if (ext >= 0) set |= (GbmExtensionSet)1 << ext;
+    }
+
+    return set;
+}
+
+uint64_t
+eGbmGetEnvUint(const char* name, uint64_t defValue)
+{
+    const char* str = getenv(name);
+    unsigned long long value;
+    char* end;
+
+    if (!str || !str[0]) return defValue;
+
+    errno = 0;
+    value = strtoull(str, &end, 0);
+
+    if (errno || *end || str[0] == '-') return defValue;
+
+    return value;
 }
 
 void
@@ -45,6 +120,8 @@ eGbmSetErrorInternal(GbmPlatformData *data, EGLint error,
     static const char *defaultMsg = "GBM external platform error";
     char msg[256];
 
+    eGbmStatsCountError(error);
+
     if (!data || !data->driver.setError) return;
 
     if (!file || (snprintf(msg, sizeof(msg), "%s:%d: %s",
@@ -10,6 +10,7 @@
 #include "gbm-platform.h"
 
 #include <EGL/egl.h>
+#include <stdint.h>
 
 #if defined(__QNX__)
 #define HAS_MINCORE 0
@@ -17,6 +18,8 @@
 #define HAS_MINCORE 1
 #endif
 
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+
 #ifdef NDEBUG
 #define eGbmSetError(data, err) \
     eGbmSetErrorInternal(data, err, NULL, 0);
@@ -25,7 +28,14 @@
     eGbmSetErrorInternal(data, err, __FILE__, __LINE__);
 #endif
 
-EGLBoolean eGbmFindExtension(const char* extension, const char* extensions);
+GbmExtensionSet eGbmParseExtensions(const char* extensions);
+
+/*
+ * Returns the value of the environment variable <name> as an unsigned
+ * integer, or <defValue> if it is unset or not a number.
+ */
+uint64_t eGbmGetEnvUint(const char* name, uint64_t defValue);
+
 void eGbmSetErrorInternal(GbmPlatformData *data, EGLint error,
                           const char *file, int line);
 
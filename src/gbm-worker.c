@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gbm-worker.h"
+
+#include <stddef.h>
+
+static void*
+WorkerThread(void* arg)
+{
+    GbmWorker* worker = arg;
+    GbmWork* work;
+
+    pthread_mutex_lock(&worker->mutex);
+
+    for (;;) {
+        while (!worker->first && !worker->quit)
+            pthread_cond_wait(&worker->workCond, &worker->mutex);
+
+        if (!worker->first) break;
+
+        work = worker->first;
+        worker->first = work->next;
+        if (!worker->first) worker->last = NULL;
+        worker->running = true;
+
+        pthread_mutex_unlock(&worker->mutex);
+        work->func(work);
+        pthread_mutex_lock(&worker->mutex);
+
+        worker->running = false;
+        if (!worker->first) pthread_cond_broadcast(&worker->idleCond);
+    }
+
+    pthread_mutex_unlock(&worker->mutex);
+
+    return NULL;
+}
+
+void
+eGbmWorkerInit(GbmWorker* worker)
+{
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->workCond, NULL);
+    pthread_cond_init(&worker->idleCond, NULL);
+}
+
+void
+eGbmWorkerFini(GbmWorker* worker)
+{
+    pthread_mutex_lock(&worker->mutex);
+    worker->quit = true;
+    pthread_cond_signal(&worker->workCond);
+    pthread_mutex_unlock(&worker->mutex);
+
+    /* The thread drains the queue before it exits */
+    if (worker->threadStarted) pthread_join(worker->thread, NULL);
+
+    pthread_cond_destroy(&worker->idleCond);
+    pthread_cond_destroy(&worker->workCond);
+    pthread_mutex_destroy(&worker->mutex);
+}
+
+bool
+eGbmWorkerQueue(GbmWorker* worker, GbmWork* work)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&worker->mutex);
+
+    if (worker->quit) goto done;
+
+    if (!worker->threadStarted) {
+        worker->threadStarted =
+            !pthread_create(&worker->thread, NULL, WorkerThread, worker);
+
+        if (!worker->threadStarted) goto done;
+    }
+
+    work->next = NULL;
+    if (worker->last)
+        worker->last->next = work;
+    else
+        worker->first = work;
+    worker->last = work;
+
+    pthread_cond_signal(&worker->workCond);
+    ret = true;
+
+done:
+    pthread_mutex_unlock(&worker->mutex);
+
+    return ret;
+}
+
+void
+eGbmWorkerFlush(GbmWorker* worker)
+{
+    pthread_mutex_lock(&worker->mutex);
+
+    if (worker->threadStarted &&
+        !pthread_equal(pthread_self(), worker->thread)) {
+        while (worker->first || worker->running)
+            pthread_cond_wait(&worker->idleCond, &worker->mutex);
+    }
+
+    pthread_mutex_unlock(&worker->mutex);
+}
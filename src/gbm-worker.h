@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GBM_WORKER_H
+#define GBM_WORKER_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * A single background thread running queued work items in FIFO order.
+ *
+ * Work items are embedded in the object they operate on, so queueing never
+ * allocates. The thread is started by the first eGbmWorkerQueue() call.
+ */
+typedef struct GbmWorkRec {
+    void (*func)(struct GbmWorkRec* work);
+    struct GbmWorkRec* next;
+} GbmWork;
+
+typedef struct GbmWorkerRec {
+    pthread_mutex_t mutex;
+    /* Signaled when work is queued, or the worker is told to quit */
+    pthread_cond_t workCond;
+    /* Signaled when the queue becomes empty and nothing is running */
+    pthread_cond_t idleCond;
+    pthread_t thread;
+    bool threadStarted;
+    bool quit;
+    bool running;
+    GbmWork* first;
+    GbmWork* last;
+} GbmWorker;
+
+void eGbmWorkerInit(GbmWorker* worker);
+
+/* Runs any work still queued, then stops the thread */
+void eGbmWorkerFini(GbmWorker* worker);
+
+/*
+ * Queues <work> to have its func run on the worker thread. Returns false if
+ * the thread could not be started, in which case the caller must do the work
+ * itself.
+ */
+bool eGbmWorkerQueue(GbmWorker* worker, GbmWork* work);
+
+/*
+ * Waits until all work queued so far has completed. Does nothing when called
+ * from a work item.
+ */
+void eGbmWorkerFlush(GbmWorker* worker);
+
+#endif /* GBM_WORKER_H */
@@ -0,0 +1,619 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Measures the CPU cost of the gbm surface frame cycle in the GBM platform:
+ * gbm_surface_lock_front_buffer(), which pumps the stream's consumer events
+ * and acquires the new frame, and gbm_surface_release_buffer(). The EGL
+ * driver and NVIDIA gbm backend are replaced by the in-process stubs, so the
+ * numbers reflect the platform's own overhead only.
+ *
+ * Every simulated refresh, each surface's producer presents one frame, which
+ * the compositor side then locks and releases. With -b, the buffers of all
+ * surfaces are locked with one egl_gbm_surfaces_lock_front_buffers() call per
+ * refresh instead. Heap allocations made during the measured refreshes are
+ * counted by interposing malloc and friends.
+ *
+ * With -c, surfaces are 4K and refreshes are paced at the refresh rate. The
+ * first surface's locked frame is read back with
+ * egl_gbm_surface_read_front_buffer() every refresh, into one of
+ * BENCH_READBACKS staging buffers, skipping the refresh if all are still in
+ * use. This checks that captures keep up without slowing the lock down.
+ *
+ * With -i, no surfaces are created. Instead, each of the given number of
+ * iterations loads and unloads the platform, which parses the client
+ * extension string, and initializes and terminates the display, which parses
+ * the display extension string and checks the extensions it needs.
+ */
+
+#include "stub-egl.h"
+#include "stub-gbm.h"
+#include "tool-platform.h"
+#include "egl-gbm-ext.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+#include <gbmint.h>
+
+/* Readbacks in flight at once with -c */
+#define BENCH_READBACKS 2
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static bool countAllocs;
+static unsigned long numAllocs;
+static unsigned long allocBytes;
+
+void *
+malloc(size_t size)
+{
+    if (countAllocs) {
+        numAllocs++;
+        allocBytes += size;
+    }
+
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if (countAllocs) {
+        numAllocs++;
+        allocBytes += nmemb * size;
+    }
+
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (countAllocs) {
+        numAllocs++;
+        allocBytes += size;
+    }
+
+    return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNTS 1
+#else
+#define HAVE_ALLOC_COUNTS 0
+#endif
+
+typedef struct BenchSurfaceRec {
+    struct gbm_surface *gbmSurf;
+    EGLSurface eglSurf;
+    EGLStreamKHR stream;
+} BenchSurface;
+
+static struct {
+    EGLExtDriver driver;
+    EGLExtPlatform platform;
+
+    PFNEGLINITIALIZEPROC Initialize;
+    PFNEGLTERMINATEPROC Terminate;
+    PFNEGLCHOOSECONFIGPROC ChooseConfig;
+    PFNEGLCREATEPLATFORMWINDOWSURFACEPROC CreatePlatformWindowSurface;
+    PFNEGLDESTROYSURFACEPROC DestroySurface;
+    PFN_EGL_GBM_SURFACES_LOCK_FRONT_BUFFERS LockFrontBuffers;
+    PFN_EGL_GBM_SURFACE_READ_FRONT_BUFFER ReadFrontBuffer;
+
+    struct gbm_device *gbm;
+    EGLDisplay dpy;
+    EGLConfig config;
+
+    BenchSurface *surfaces;
+    unsigned int numSurfaces;
+
+    /* Only used with -b */
+    struct gbm_surface **gbmSurfs;
+    struct gbm_bo **bos;
+
+    /* Only used with -c */
+    struct {
+        struct {
+            uint8_t *staging;
+            bool pending;
+            uint64_t queuedNs;
+        } bufs[BENCH_READBACKS];
+        uint32_t stride;
+        /* Time between refreshes, or 0 to run unpaced */
+        uint64_t periodNs;
+        uint64_t startNs;
+        uint64_t queueNs;
+        unsigned long queued;
+        unsigned long completed;
+        unsigned long failed;
+        uint64_t totalNs;
+    } readback;
+} bench;
+
+static bool
+LoadPlatform(const char *path)
+{
+    if (!ToolLoadPlatform(path, &bench.driver, &bench.platform)) return false;
+
+#define GET_HOOK(_field, _name) \
+    if (!(bench._field = ToolGetHook(&bench.platform, _name))) return false
+
+    GET_HOOK(Initialize, "eglInitialize");
+    GET_HOOK(Terminate, "eglTerminate");
+    GET_HOOK(ChooseConfig, "eglChooseConfig");
+    GET_HOOK(CreatePlatformWindowSurface, "eglCreatePlatformWindowSurface");
+    GET_HOOK(DestroySurface, "eglDestroySurface");
+
+#undef GET_HOOK
+
+    bench.LockFrontBuffers =
+        ToolGetPlatformSymbol("egl_gbm_surfaces_lock_front_buffers");
+    bench.ReadFrontBuffer =
+        ToolGetPlatformSymbol("egl_gbm_surface_read_front_buffer");
+
+    return true;
+}
+
+static bool
+CreateDisplay(void)
+{
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_NATIVE_VISUAL_ID, DRM_FORMAT_XRGB8888,
+        EGL_NONE
+    };
+    EGLint major, minor, n;
+
+    if (!(bench.gbm = StubGbmCreateDevice())) {
+        fprintf(stderr, "Failed to create a gbm device\n");
+        return false;
+    }
+
+    bench.dpy = bench.platform.exports.getPlatformDisplay(
+        bench.platform.data, EGL_PLATFORM_GBM_KHR, bench.gbm, NULL);
+
+    if (bench.dpy == EGL_NO_DISPLAY ||
+        !bench.Initialize(bench.dpy, &major, &minor)) {
+        fprintf(stderr, "Failed to initialize the display\n");
+        return false;
+    }
+
+    if (!bench.ChooseConfig(bench.dpy, configAttribs, &bench.config, 1, &n) ||
+        n < 1) {
+        fprintf(stderr, "No XRGB8888 window config\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+CreateSurfaces(unsigned int count, uint32_t width, uint32_t height)
+{
+    unsigned int i;
+
+    if (!(bench.surfaces = calloc(count, sizeof(*bench.surfaces)))) return false;
+
+    for (i = 0; i < count; i++) {
+        BenchSurface *surf = &bench.surfaces[i];
+
+        surf->gbmSurf = StubGbmCreateSurface(bench.gbm, width, height,
+                                             DRM_FORMAT_XRGB8888,
+                                             GBM_BO_USE_RENDERING |
+                                             GBM_BO_USE_SCANOUT,
+                                             NULL, 0);
+        if (!surf->gbmSurf) break;
+
+        surf->eglSurf = bench.CreatePlatformWindowSurface(bench.dpy,
+                                                          bench.config,
+                                                          surf->gbmSurf,
+                                                          NULL);
+        if (surf->eglSurf == EGL_NO_SURFACE) {
+            StubGbmDestroySurface(surf->gbmSurf);
+            break;
+        }
+
+        surf->stream = StubEglLastStream();
+        bench.numSurfaces++;
+    }
+
+    if (bench.numSurfaces != count) {
+        fprintf(stderr, "Created only %u of %u surfaces\n",
+                bench.numSurfaces, count);
+        return false;
+    }
+
+    bench.gbmSurfs = calloc(count, sizeof(*bench.gbmSurfs));
+    bench.bos = calloc(count, sizeof(*bench.bos));
+
+    if (!bench.gbmSurfs || !bench.bos) return false;
+
+    for (i = 0; i < count; i++)
+        bench.gbmSurfs[i] = bench.surfaces[i].gbmSurf;
+
+    return true;
+}
+
+static void
+DestroySurfaces(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < bench.numSurfaces; i++) {
+        bench.DestroySurface(bench.dpy, bench.surfaces[i].eglSurf);
+        StubGbmDestroySurface(bench.surfaces[i].gbmSurf);
+    }
+
+    free(bench.surfaces);
+    free(bench.gbmSurfs);
+    free(bench.bos);
+    bench.surfaces = NULL;
+    bench.gbmSurfs = NULL;
+    bench.bos = NULL;
+    bench.numSurfaces = 0;
+}
+
+/* Sleeps until refresh <r> of a paced run is due */
+static void
+WaitForRefresh(unsigned int r)
+{
+    uint64_t due = bench.readback.startNs + r * bench.readback.periodNs;
+    uint64_t now = ToolNow();
+
+    if (now < due) usleep((due - now) / 1000);
+}
+
+/* Runs on the platform's readback thread, one readback at a time */
+static void
+ReadbackDone(struct gbm_bo *bo, int status, void *data)
+{
+    unsigned int b = (unsigned int)(uintptr_t)data;
+    uint64_t now = ToolNow();
+
+    (void)bo;
+
+    if (status || bench.readback.bufs[b].staging[0] != STUB_MAP_PATTERN)
+        bench.readback.failed++;
+
+    bench.readback.completed++;
+    bench.readback.totalNs += now - bench.readback.bufs[b].queuedNs;
+    __atomic_store_n(&bench.readback.bufs[b].pending, false, __ATOMIC_RELEASE);
+}
+
+/* Whether any readback is still running */
+static bool
+ReadbackPending(void)
+{
+    unsigned int b;
+
+    for (b = 0; b < BENCH_READBACKS; b++) {
+        if (__atomic_load_n(&bench.readback.bufs[b].pending, __ATOMIC_ACQUIRE))
+            return true;
+    }
+
+    return false;
+}
+
+/* Queues a readback of <bo> unless every staging buffer is in use */
+static void
+MaybeReadBack(struct gbm_surface *s, struct gbm_bo *bo)
+{
+    unsigned int b;
+
+    for (b = 0; b < BENCH_READBACKS; b++) {
+        if (!__atomic_load_n(&bench.readback.bufs[b].pending, __ATOMIC_ACQUIRE))
+            break;
+    }
+
+    if (b == BENCH_READBACKS) return;
+
+    bench.readback.bufs[b].staging[0] = 0;
+    bench.readback.bufs[b].pending = true;
+    bench.readback.bufs[b].queuedNs = ToolNow();
+
+    if (bench.ReadFrontBuffer(s, bo, bench.readback.bufs[b].staging,
+                              bench.readback.stride, ReadbackDone,
+                              (void *)(uintptr_t)b)) {
+        bench.readback.bufs[b].pending = false;
+        bench.readback.failed++;
+        return;
+    }
+
+    bench.readback.queued++;
+}
+
+/*
+ * Runs <refreshes> refresh cycles over every surface, adding the time spent
+ * in lock and release to <lockNs> and <releaseNs>. Returns the number of
+ * frames that were locked.
+ */
+static unsigned long
+RunRefreshes(unsigned int refreshes, uint64_t *lockNs, uint64_t *releaseNs)
+{
+    unsigned long frames = 0;
+    unsigned int r, i;
+
+    for (r = 0; r < refreshes; r++) {
+        for (i = 0; i < bench.numSurfaces; i++) {
+            BenchSurface *surf = &bench.surfaces[i];
+            struct gbm_surface *s = surf->gbmSurf;
+            struct gbm_bo *bo;
+            uint64_t t0, t1, t2, lockEnd;
+
+            StubEglStreamPresent(surf->stream);
+
+            t0 = ToolNow();
+            bo = s->gbm->v0.surface_lock_front_buffer(s);
+            t1 = lockEnd = ToolNow();
+
+            if (!bo) continue;
+
+            /* Queueing the readback is reported separately */
+            if (i == 0 && bench.readback.stride) {
+                MaybeReadBack(s, bo);
+                t1 = ToolNow();
+                bench.readback.queueNs += t1 - lockEnd;
+            }
+
+            s->gbm->v0.surface_release_buffer(s, bo);
+            t2 = ToolNow();
+
+            *lockNs += lockEnd - t0;
+            *releaseNs += t2 - t1;
+            frames++;
+        }
+
+        if (bench.readback.periodNs) WaitForRefresh(r + 1);
+    }
+
+    return frames;
+}
+
+/* Like RunRefreshes(), locking every surface's buffer in a single call */
+static unsigned long
+RunBatchedRefreshes(unsigned int refreshes, uint64_t *lockNs,
+                    uint64_t *releaseNs)
+{
+    unsigned long frames = 0;
+    unsigned int r, i;
+    uint64_t t0, t1, t2;
+    int locked;
+
+    for (r = 0; r < refreshes; r++) {
+        for (i = 0; i < bench.numSurfaces; i++)
+            StubEglStreamPresent(bench.surfaces[i].stream);
+
+        t0 = ToolNow();
+        locked = bench.LockFrontBuffers(bench.gbmSurfs, bench.numSurfaces,
+                                        0, bench.bos);
+        t1 = ToolNow();
+
+        for (i = 0; i < bench.numSurfaces; i++) {
+            struct gbm_surface *s = bench.gbmSurfs[i];
+
+            if (bench.bos[i])
+                s->gbm->v0.surface_release_buffer(s, bench.bos[i]);
+        }
+        t2 = ToolNow();
+
+        if (locked > 0) {
+            *lockNs += t1 - t0;
+            *releaseNs += t2 - t1;
+            frames += locked;
+        }
+    }
+
+    return frames;
+}
+
+/*
+ * Runs <iterations> platform load and display initialization cycles, adding
+ * the time spent to <loadNs> and <initNs>. Returns false if any failed.
+ */
+static bool
+RunInitCycles(unsigned int iterations, uint64_t *loadNs, uint64_t *initNs)
+{
+    EGLExtPlatform platform;
+    EGLint major, minor;
+    unsigned int i;
+    uint64_t t0, t1;
+    bool ok;
+
+    for (i = 0; i < iterations; i++) {
+        t0 = ToolNow();
+        ok = ToolReloadPlatform(&bench.driver, &platform);
+        if (ok) platform.exports.unloadEGLExternalPlatform(platform.data);
+        t1 = ToolNow();
+
+        if (!ok) return false;
+
+        *loadNs += t1 - t0;
+
+        /* The display was initialized by CreateDisplay() */
+        t0 = ToolNow();
+        bench.Terminate(bench.dpy);
+        ok = bench.Initialize(bench.dpy, &major, &minor);
+        t1 = ToolNow();
+
+        if (!ok) return false;
+
+        *initNs += t1 - t0;
+    }
+
+    return true;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *library = TOOL_DEFAULT_PLATFORM;
+    unsigned int numSurfaces = 1000;
+    unsigned int refreshes = 1000;
+    unsigned int hz = 240;
+    bool batched = false;
+    bool capture = false;
+    bool init = false;
+    uint32_t width = 1920, height = 1080;
+    uint64_t lockNs = 0, releaseNs = 0, start, elapsed;
+    unsigned long frames, expected;
+    double frameNs;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bcil:s:n:r:")) != -1) {
+        switch (opt) {
+        case 'b':
+            batched = true;
+            break;
+        case 'c':
+            capture = true;
+            width = 3840;
+            height = 2160;
+            break;
+        case 'i':
+            init = true;
+            break;
+        case 'l':
+            library = optarg;
+            break;
+        case 's':
+            numSurfaces = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            refreshes = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            hz = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc || !numSurfaces || !refreshes || !hz ||
+        (batched + capture + init) > 1)
+        goto usage;
+
+    if (init) {
+        if (!LoadPlatform(library) || !CreateDisplay()) return 1;
+
+        if (!RunInitCycles(refreshes, &lockNs, &releaseNs)) {
+            fprintf(stderr, "Failed to reload the platform or display\n");
+            return 1;
+        }
+
+        printf("%u iterations\n", refreshes);
+        printf("load + unload      %10.1f ns/iteration\n",
+               (double)lockNs / refreshes);
+        printf("init + terminate   %10.1f ns/iteration\n",
+               (double)releaseNs / refreshes);
+        printf("platform errors    %10lu\n", StubEglErrorCount());
+
+        bench.Terminate(bench.dpy);
+        bench.platform.exports.unloadEGLExternalPlatform(bench.platform.data);
+        StubGbmDestroyDevice(bench.gbm);
+
+        return 0;
+    }
+
+    if (!LoadPlatform(library) || !CreateDisplay() ||
+        !CreateSurfaces(numSurfaces, width, height))
+        return 1;
+
+    if (batched && !bench.LockFrontBuffers) {
+        fprintf(stderr, "The platform has no batched lock\n");
+        return 1;
+    }
+
+    if (capture && !bench.ReadFrontBuffer) {
+        fprintf(stderr, "The platform has no front buffer readback\n");
+        return 1;
+    }
+
+    /* The first frame of each image imports its gbm_bo; keep that out */
+    RunRefreshes(STUB_STREAM_IMAGES, &lockNs, &releaseNs);
+    lockNs = releaseNs = 0;
+
+    if (capture) {
+        bench.readback.stride = width * 4;
+
+        for (i = 0; i < BENCH_READBACKS; i++) {
+            uint8_t **staging = &bench.readback.bufs[i].staging;
+
+            if (!(*staging = calloc(height, bench.readback.stride))) return 1;
+
+            /* Fault the staging buffer in before measuring */
+            memset(*staging, 0, (size_t)bench.readback.stride * height);
+        }
+
+        bench.readback.periodNs = 1000000000ull / hz;
+    }
+
+#if HAVE_ALLOC_COUNTS
+    countAllocs = true;
+#endif
+    start = bench.readback.startNs = ToolNow();
+    frames = batched ? RunBatchedRefreshes(refreshes, &lockNs, &releaseNs) :
+                       RunRefreshes(refreshes, &lockNs, &releaseNs);
+    elapsed = ToolNow() - start;
+#if HAVE_ALLOC_COUNTS
+    countAllocs = false;
+#endif
+
+    while (ReadbackPending()) usleep(1000);
+
+    expected = (unsigned long)refreshes * bench.numSurfaces;
+
+    if (!frames) {
+        fprintf(stderr, "No frames were locked\n");
+        return 1;
+    }
+
+    frameNs = (double)(lockNs + releaseNs) / frames;
+
+    printf("%u surfaces, %u refreshes%s: %lu of %lu frames locked\n",
+           bench.numSurfaces, refreshes, batched ? ", batched" : "",
+           frames, expected);
+    printf("lock_front_buffer  %10.1f ns/frame\n", (double)lockNs / frames);
+    printf("release_buffer     %10.1f ns/frame\n", (double)releaseNs / frames);
+    printf("lock + release     %10.1f ns/frame\n", frameNs);
+    printf("refresh cycle      %10.1f ns/frame (including stub producer)\n",
+           (double)elapsed / frames);
+#if HAVE_ALLOC_COUNTS
+    printf("allocations        %10.3f /frame, %.1f bytes/frame\n",
+           (double)numAllocs / frames, (double)allocBytes / frames);
+#endif
+    printf("at %u Hz           %10.3f%% of one CPU\n", hz,
+           frameNs * bench.numSurfaces * hz / 1e7);
+    if (capture && bench.readback.queued) {
+        printf("read_front_buffer  %10.1f ns/call to queue\n",
+               (double)bench.readback.queueNs / bench.readback.queued);
+        printf("readback           %10.3f ms each, %lu of %u refreshes "
+               "captured, %lu failed\n",
+               (double)bench.readback.totalNs / bench.readback.completed / 1e6,
+               bench.readback.completed, refreshes, bench.readback.failed);
+    }
+    printf("platform errors    %10lu\n", StubEglErrorCount());
+
+    DestroySurfaces();
+    for (i = 0; i < BENCH_READBACKS; i++) free(bench.readback.bufs[i].staging);
+    bench.Terminate(bench.dpy);
+    bench.platform.exports.unloadEGLExternalPlatform(bench.platform.data);
+    StubGbmDestroyDevice(bench.gbm);
+
+    return frames == expected ? 0 : 1;
+
+usage:
+    fprintf(stderr,
+            "usage: %s [-b | -c | -i] [-l platform-library] [-s surfaces] "
+            "[-n refreshes] [-r refresh-hz]\n", argv[0]);
+    return 2;
+}
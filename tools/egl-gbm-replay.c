@@ -0,0 +1,758 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Replays a call recording made with EGL_GBM_RECORD against the GBM platform
+ * library, using the stub EGL driver and fake gbm devices in place of the
+ * real driver and NVIDIA gbm backend, and reports how long the platform spent
+ * in each entry point.
+ *
+ * Handles are translated from their recorded values to the replayed ones by
+ * watching the *_return events. Frames are reproduced by presenting on the
+ * stub stream whenever the recording shows an EGL_STREAM_IMAGE_AVAILABLE_NV
+ * event consumed within a lock or has-free-buffers call. All calls are issued
+ * from a single thread in recording order.
+ */
+
+#include "stub-egl.h"
+#include "stub-gbm.h"
+#include "tool-platform.h"
+#include "gbm-record-format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gbmint.h>
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+
+#define MAX_CONFIGS 64
+
+/* The recorded operations the replay acts upon */
+#define REPLAY_OPS(X)                           \
+    X(get_platform_display_entry)               \
+    X(get_platform_display_return)              \
+    X(is_valid_native_display_entry)            \
+    X(query_string_entry)                       \
+    X(get_internal_handle_entry)                \
+    X(initialize_entry)                         \
+    X(terminate_entry)                          \
+    X(query_display_attrib_entry)               \
+    X(choose_config_attribs)                    \
+    X(choose_config_entry)                      \
+    X(get_config_attrib_entry)                  \
+    X(window_surface_desc)                      \
+    X(create_platform_window_surface_entry)     \
+    X(create_platform_window_surface_return)    \
+    X(destroy_surface_entry)                    \
+    X(has_free_buffers_entry)                   \
+    X(has_free_buffers_return)                  \
+    X(lock_front_buffer_entry)                  \
+    X(lock_front_buffer_return)                 \
+    X(release_buffer_entry)                     \
+    X(stream_event)
+
+typedef enum {
+    OP_UNKNOWN,
+#define X(_NAME) OP_##_NAME,
+    REPLAY_OPS(X)
+#undef X
+    OP_COUNT
+} ReplayOp;
+
+static const char *opNames[OP_COUNT] = {
+    [OP_UNKNOWN] = "unknown",
+#define X(_NAME) [OP_##_NAME] = #_NAME,
+    REPLAY_OPS(X)
+#undef X
+};
+
+typedef struct EventRec {
+    ReplayOp op;
+    uint32_t tid;
+    unsigned int argc;
+    const int64_t *args;
+} Event;
+
+typedef struct MappingRec {
+    int64_t recorded;
+    void *replayed;
+    void *extra;
+} Mapping;
+
+typedef struct MapRec {
+    Mapping *entries;
+    size_t count;
+    size_t capacity;
+} Map;
+
+typedef struct PendingRec {
+    uint32_t tid;
+    ReplayOp op;
+    void *result;
+    void *extra;
+} Pending;
+
+static struct {
+    EGLExtPlatform platform;
+    EGLExtDriver driver;
+
+    PFNEGLINITIALIZEPROC Initialize;
+    PFNEGLTERMINATEPROC Terminate;
+    PFNEGLCHOOSECONFIGPROC ChooseConfig;
+    PFNEGLGETCONFIGATTRIBPROC GetConfigAttrib;
+    PFNEGLQUERYDISPLAYATTRIBKHRPROC QueryDisplayAttrib;
+    PFNEGLCREATEPLATFORMWINDOWSURFACEPROC CreatePlatformWindowSurface;
+    PFNEGLDESTROYSURFACEPROC DestroySurface;
+
+    /* Recorded handle -> replayed handle */
+    Map nativeDisplays;     /* extra: unused */
+    Map displays;           /* extra: gbm device */
+    Map nativeWindows;      /* extra: stub stream */
+    Map surfaces;           /* extra: unused */
+    Map bos;                /* extra: unused */
+
+    Pending *pending;
+    size_t numPending;
+    size_t maxPending;
+
+    EGLint chooseAttribs[256];
+    bool haveChooseAttribs;
+    const Event *windowDesc;
+
+    struct {
+        unsigned long calls;
+        uint64_t totalNs;
+    } stats[OP_COUNT];
+
+    unsigned long frames;
+    unsigned long skipped;
+} replay;
+
+static Mapping *
+MapFind(Map *map, int64_t recorded)
+{
+    size_t i;
+
+    /* Search from the end; recently created handles are looked up most */
+    for (i = map->count; i > 0; i--) {
+        if (map->entries[i - 1].recorded == recorded)
+            return &map->entries[i - 1];
+    }
+
+    return NULL;
+}
+
+static void *
+MapGet(Map *map, int64_t recorded)
+{
+    Mapping *m = MapFind(map, recorded);
+
+    return m ? m->replayed : NULL;
+}
+
+static bool
+MapSet(Map *map, int64_t recorded, void *replayed, void *extra)
+{
+    Mapping *m = MapFind(map, recorded);
+
+    if (!m) {
+        if (map->count == map->capacity) {
+            size_t capacity = map->capacity ? map->capacity * 2 : 16;
+            Mapping *entries = realloc(map->entries,
+                                       capacity * sizeof(*entries));
+
+            if (!entries) return false;
+
+            map->entries = entries;
+            map->capacity = capacity;
+        }
+
+        m = &map->entries[map->count++];
+        m->recorded = recorded;
+    }
+
+    m->replayed = replayed;
+    m->extra = extra;
+
+    return true;
+}
+
+static void
+SetPending(uint32_t tid, ReplayOp op, void *result, void *extra)
+{
+    size_t i;
+
+    for (i = 0; i < replay.numPending; i++) {
+        if (replay.pending[i].tid == tid && replay.pending[i].op == op)
+            break;
+    }
+
+    if (i == replay.numPending) {
+        if (replay.numPending == replay.maxPending) {
+            size_t max = replay.maxPending ? replay.maxPending * 2 : 8;
+            Pending *pending = realloc(replay.pending, max * sizeof(*pending));
+
+            if (!pending) return;
+
+            replay.pending = pending;
+            replay.maxPending = max;
+        }
+
+        replay.numPending++;
+    }
+
+    replay.pending[i].tid = tid;
+    replay.pending[i].op = op;
+    replay.pending[i].result = result;
+    replay.pending[i].extra = extra;
+}
+
+static bool
+TakePending(uint32_t tid, ReplayOp op, void **result, void **extra)
+{
+    size_t i;
+
+    for (i = 0; i < replay.numPending; i++) {
+        if (replay.pending[i].tid == tid && replay.pending[i].op == op) {
+            *result = replay.pending[i].result;
+            if (extra) *extra = replay.pending[i].extra;
+            replay.pending[i] = replay.pending[--replay.numPending];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+Account(ReplayOp op, uint64_t start)
+{
+    replay.stats[op].calls++;
+    replay.stats[op].totalNs += ToolNow() - start;
+}
+
+static struct gbm_device *
+GetNativeDisplay(int64_t recorded)
+{
+    struct gbm_device *gbm = MapGet(&replay.nativeDisplays, recorded);
+
+    /*
+     * EGL_DEFAULT_DISPLAY is replayed with a fake device as well; the real
+     * DRM device nodes are of no use to the stub driver.
+     */
+    if (!gbm && (gbm = StubGbmCreateDevice()))
+        MapSet(&replay.nativeDisplays, recorded, gbm, NULL);
+
+    return gbm;
+}
+
+/*
+ * Reproduces the frames the producer had completed by the time the recorded
+ * call at <events>[<idx>] returned.
+ */
+static void
+PresentFrames(const Event *events, size_t numEvents, size_t idx,
+              ReplayOp returnOp, EGLStreamKHR stream)
+{
+    const Event *entry = &events[idx];
+    size_t i;
+
+    for (i = idx + 1; i < numEvents; i++) {
+        const Event *ev = &events[i];
+
+        if (ev->tid != entry->tid) continue;
+        if (ev->op == returnOp) break;
+
+        if (ev->op == OP_stream_event && ev->argc >= 2 &&
+            ev->args[1] == EGL_STREAM_IMAGE_AVAILABLE_NV) {
+            if (StubEglStreamPresent(stream))
+                replay.frames++;
+        }
+    }
+}
+
+static void
+ReplayEvent(const Event *events, size_t numEvents, size_t idx)
+{
+    const Event *ev = &events[idx];
+    const int64_t *a = ev->args;
+    void *result = NULL;
+    void *extra = NULL;
+    uint64_t start;
+
+#define NEED_ARGS(_n) do { if (ev->argc < (_n)) goto skip; } while (0)
+
+    switch (ev->op) {
+    case OP_get_platform_display_entry: {
+        struct gbm_device *gbm;
+
+        NEED_ARGS(2);
+        if (!(gbm = GetNativeDisplay(a[1]))) goto skip;
+
+        start = ToolNow();
+        result = replay.platform.exports.getPlatformDisplay(
+            replay.platform.data, (EGLenum)a[0], gbm, NULL);
+        Account(ev->op, start);
+        SetPending(ev->tid, ev->op, result, gbm);
+        break;
+    }
+    case OP_get_platform_display_return:
+        NEED_ARGS(2);
+        if (!TakePending(ev->tid, OP_get_platform_display_entry,
+                         &result, &extra) || !result)
+            goto skip;
+        MapSet(&replay.displays, a[1], result, extra);
+        break;
+    case OP_is_valid_native_display_entry: {
+        struct gbm_device *gbm;
+
+        NEED_ARGS(1);
+        if (!(gbm = GetNativeDisplay(a[0]))) goto skip;
+
+        start = ToolNow();
+        replay.platform.exports.isValidNativeDisplay(replay.platform.data, gbm);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_query_string_entry: {
+        EGLDisplay dpy;
+
+        NEED_ARGS(2);
+        dpy = MapGet(&replay.displays, a[0]);
+        if (a[0] && !dpy) goto skip;
+
+        start = ToolNow();
+        replay.platform.exports.queryString(replay.platform.data, dpy,
+                                            (EGLExtPlatformString)a[1]);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_get_internal_handle_entry: {
+        EGLDisplay dpy;
+        void *handle;
+
+        NEED_ARGS(3);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        handle = a[1] == EGL_OBJECT_DISPLAY_KHR ?
+            MapGet(&replay.displays, a[2]) :
+            MapGet(&replay.surfaces, a[2]);
+        if (!handle) goto skip;
+
+        start = ToolNow();
+        replay.platform.exports.getInternalHandle(dpy, (EGLenum)a[1], handle);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_initialize_entry: {
+        EGLDisplay dpy;
+        EGLint major, minor;
+
+        NEED_ARGS(1);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        start = ToolNow();
+        replay.Initialize(dpy, &major, &minor);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_terminate_entry: {
+        EGLDisplay dpy;
+
+        NEED_ARGS(1);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        start = ToolNow();
+        replay.Terminate(dpy);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_query_display_attrib_entry: {
+        EGLDisplay dpy;
+        EGLAttrib value;
+
+        NEED_ARGS(2);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        start = ToolNow();
+        replay.QueryDisplayAttrib(dpy, (EGLint)a[1], &value);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_choose_config_attribs: {
+        unsigned int i;
+
+        if (ev->argc > ARRAY_LEN(replay.chooseAttribs)) goto skip;
+
+        for (i = 0; i < ev->argc; i++)
+            replay.chooseAttribs[i] = (EGLint)a[i];
+        replay.haveChooseAttribs = true;
+        break;
+    }
+    case OP_choose_config_entry: {
+        EGLConfig configs[MAX_CONFIGS];
+        EGLDisplay dpy;
+        EGLint n;
+
+        NEED_ARGS(1);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        start = ToolNow();
+        replay.ChooseConfig(dpy,
+                            replay.haveChooseAttribs ?
+                                replay.chooseAttribs : NULL,
+                            configs, MAX_CONFIGS, &n);
+        Account(ev->op, start);
+        replay.haveChooseAttribs = false;
+        break;
+    }
+    case OP_get_config_attrib_entry: {
+        EGLDisplay dpy;
+        EGLint value;
+
+        NEED_ARGS(3);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+
+        /* Recorded configs belong to the real driver; any stub config will do */
+        start = ToolNow();
+        replay.GetConfigAttrib(dpy, StubEglAnyConfig(), (EGLint)a[2], &value);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_window_surface_desc:
+        NEED_ARGS(6);
+        replay.windowDesc = ev;
+        break;
+    case OP_create_platform_window_surface_entry: {
+        const Event *desc = replay.windowDesc;
+        Mapping *dpyMap;
+        struct gbm_surface *s;
+        unsigned int count;
+        uint64_t *modifiers = NULL;
+        unsigned int i;
+
+        NEED_ARGS(3);
+        replay.windowDesc = NULL;
+        if (!(dpyMap = MapFind(&replay.displays, a[0]))) goto skip;
+        if (!desc || desc->args[0] != a[2]) goto skip;
+
+        count = desc->argc - 6;
+        if (count) {
+            if (!(modifiers = malloc(count * sizeof(*modifiers)))) goto skip;
+            for (i = 0; i < count; i++)
+                modifiers[i] = (uint64_t)desc->args[6 + i];
+        }
+
+        s = StubGbmCreateSurface(dpyMap->extra,
+                                 (uint32_t)desc->args[1],
+                                 (uint32_t)desc->args[2],
+                                 (uint32_t)desc->args[3],
+                                 (uint32_t)desc->args[4],
+                                 modifiers, count);
+        free(modifiers);
+        if (!s) goto skip;
+
+        start = ToolNow();
+        result = replay.CreatePlatformWindowSurface(dpyMap->replayed,
+                                                    StubEglAnyConfig(), s,
+                                                    NULL);
+        Account(ev->op, start);
+
+        MapSet(&replay.nativeWindows, a[2], s,
+               result != EGL_NO_SURFACE ? StubEglLastStream() : NULL);
+        SetPending(ev->tid, ev->op, result, NULL);
+        break;
+    }
+    case OP_create_platform_window_surface_return:
+        NEED_ARGS(2);
+        if (!TakePending(ev->tid, OP_create_platform_window_surface_entry,
+                         &result, &extra) || result == EGL_NO_SURFACE)
+            goto skip;
+        MapSet(&replay.surfaces, a[1], result, extra);
+        break;
+    case OP_destroy_surface_entry: {
+        EGLDisplay dpy;
+        EGLSurface surf;
+
+        NEED_ARGS(2);
+        if (!(dpy = MapGet(&replay.displays, a[0]))) goto skip;
+        if (!(surf = MapGet(&replay.surfaces, a[1]))) goto skip;
+
+        start = ToolNow();
+        replay.DestroySurface(dpy, surf);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_has_free_buffers_entry:
+    case OP_lock_front_buffer_entry: {
+        ReplayOp returnOp = ev->op == OP_has_free_buffers_entry ?
+            OP_has_free_buffers_return : OP_lock_front_buffer_return;
+        struct gbm_surface *s;
+        Mapping *win;
+
+        NEED_ARGS(1);
+        if (!(win = MapFind(&replay.nativeWindows, a[0]))) goto skip;
+        s = win->replayed;
+
+        PresentFrames(events, numEvents, idx, returnOp, win->extra);
+
+        start = ToolNow();
+        if (ev->op == OP_has_free_buffers_entry) {
+            s->gbm->v0.surface_has_free_buffers(s);
+        } else {
+            result = s->gbm->v0.surface_lock_front_buffer(s);
+        }
+        Account(ev->op, start);
+
+        if (ev->op == OP_lock_front_buffer_entry)
+            SetPending(ev->tid, ev->op, result, NULL);
+        break;
+    }
+    case OP_lock_front_buffer_return:
+        NEED_ARGS(2);
+        if (!TakePending(ev->tid, OP_lock_front_buffer_entry, &result, NULL) ||
+            !result)
+            goto skip;
+        MapSet(&replay.bos, a[1], result, NULL);
+        break;
+    case OP_release_buffer_entry: {
+        struct gbm_surface *s;
+        struct gbm_bo *bo;
+
+        NEED_ARGS(2);
+        if (!(s = MapGet(&replay.nativeWindows, a[0]))) goto skip;
+        if (!(bo = MapGet(&replay.bos, a[1]))) goto skip;
+
+        start = ToolNow();
+        s->gbm->v0.surface_release_buffer(s, bo);
+        Account(ev->op, start);
+        break;
+    }
+    case OP_has_free_buffers_return:
+    case OP_stream_event:
+    case OP_UNKNOWN:
+    case OP_COUNT:
+        break;
+    }
+
+#undef NEED_ARGS
+
+    return;
+
+skip:
+    replay.skipped++;
+}
+
+static ReplayOp
+LookupOp(const char *name, uint32_t len)
+{
+    unsigned int i;
+
+    for (i = OP_UNKNOWN + 1; i < OP_COUNT; i++) {
+        if (strlen(opNames[i]) == len && !memcmp(opNames[i], name, len))
+            return i;
+    }
+
+    return OP_UNKNOWN;
+}
+
+static void *
+ReadFile(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    long len;
+
+    if (!f) return NULL;
+
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET))
+        goto done;
+
+    if (!(buf = malloc(len ? len : 1))) goto done;
+
+    if (fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+        goto done;
+    }
+
+    *size = len;
+
+done:
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Splits the recording into events, translating the recorded operation
+ * numbers to ReplayOp through the names in the file header.
+ */
+static Event *
+ParseRecording(const uint8_t *buf, size_t size, size_t *numEvents)
+{
+    GbmRecordFileHeader hdr;
+    ReplayOp *ops = NULL;
+    Event *events = NULL;
+    size_t count = 0, max = 0;
+    size_t off = sizeof(hdr);
+    uint32_t i;
+
+    if (size < sizeof(hdr)) goto fail;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (memcmp(hdr.magic, GBM_RECORD_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != GBM_RECORD_VERSION) {
+        fprintf(stderr, "Not a version %d egl-gbm recording\n",
+                GBM_RECORD_VERSION);
+        goto fail;
+    }
+
+    if (!(ops = calloc(hdr.numOps ? hdr.numOps : 1, sizeof(*ops)))) goto fail;
+
+    for (i = 0; i < hdr.numOps; i++) {
+        uint32_t len;
+
+        if (size - off < sizeof(len)) goto truncated;
+        memcpy(&len, buf + off, sizeof(len));
+        off += sizeof(len);
+
+        if (size - off < len) goto truncated;
+        ops[i] = LookupOp((const char *)buf + off, len);
+        off += len;
+    }
+
+    while (size - off >= sizeof(GbmRecordEvent)) {
+        GbmRecordEvent rec;
+        Event *ev;
+
+        memcpy(&rec, buf + off, sizeof(rec));
+        off += sizeof(rec);
+
+        if ((size - off) / sizeof(int64_t) < rec.argc) goto truncated;
+
+        if (count == max) {
+            size_t newMax = max ? max * 2 : 1024;
+            Event *newEvents = realloc(events, newMax * sizeof(*newEvents));
+
+            if (!newEvents) goto fail;
+
+            events = newEvents;
+            max = newMax;
+        }
+
+        ev = &events[count++];
+        ev->op = rec.op < hdr.numOps ? ops[rec.op] : OP_UNKNOWN;
+        ev->tid = rec.tid;
+        ev->argc = rec.argc;
+        /* The file buffer is malloc'd and every record is 8-byte aligned */
+        ev->args = (const int64_t *)(buf + off);
+        off += rec.argc * sizeof(int64_t);
+    }
+
+    free(ops);
+    *numEvents = count;
+    return events;
+
+truncated:
+    fprintf(stderr, "Truncated recording\n");
+fail:
+    free(ops);
+    free(events);
+    return NULL;
+}
+
+static bool
+LoadPlatform(const char *path)
+{
+    if (!ToolLoadPlatform(path, &replay.driver, &replay.platform))
+        return false;
+
+#define GET_HOOK(_field, _name) \
+    if (!(replay._field = ToolGetHook(&replay.platform, _name))) return false
+
+    GET_HOOK(Initialize, "eglInitialize");
+    GET_HOOK(Terminate, "eglTerminate");
+    GET_HOOK(ChooseConfig, "eglChooseConfig");
+    GET_HOOK(GetConfigAttrib, "eglGetConfigAttrib");
+    GET_HOOK(QueryDisplayAttrib, "eglQueryDisplayAttribKHR");
+    GET_HOOK(CreatePlatformWindowSurface, "eglCreatePlatformWindowSurface");
+    GET_HOOK(DestroySurface, "eglDestroySurface");
+
+#undef GET_HOOK
+
+    return true;
+}
+
+static void
+PrintStats(void)
+{
+    unsigned int i;
+
+    printf("%-40s %10s %14s %12s\n", "operation", "calls", "total (us)",
+           "avg (ns)");
+
+    for (i = 0; i < OP_COUNT; i++) {
+        if (!replay.stats[i].calls) continue;
+
+        printf("%-40s %10lu %14.1f %12.0f\n", opNames[i],
+               replay.stats[i].calls,
+               replay.stats[i].totalNs / 1000.0,
+               (double)replay.stats[i].totalNs / replay.stats[i].calls);
+    }
+
+    printf("\n%lu frames presented, %lu events skipped, "
+           "%lu platform errors, %lu buffers still imported\n",
+           replay.frames, replay.skipped, StubEglErrorCount(),
+           StubGbmLiveBos());
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *library = TOOL_DEFAULT_PLATFORM;
+    uint8_t *buf;
+    Event *events;
+    size_t size, numEvents, i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        switch (opt) {
+        case 'l':
+            library = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc - 1) goto usage;
+
+    if (!(buf = ReadFile(argv[optind], &size))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (!(events = ParseRecording(buf, size, &numEvents))) return 1;
+
+    if (!LoadPlatform(library)) return 1;
+
+    for (i = 0; i < numEvents; i++)
+        ReplayEvent(events, numEvents, i);
+
+    PrintStats();
+
+    replay.platform.exports.unloadEGLExternalPlatform(replay.platform.data);
+
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-l platform-library] recording\n", argv[0]);
+    return 2;
+}
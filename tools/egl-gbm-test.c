@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks the GBM platform against the in-process stub EGL driver and gbm
+ * backend. Each test creates its own display, so a failed one doesn't affect
+ * the next. Run under a memory checker, as most failures are use-after-free.
+ */
+
+#include "stub-egl.h"
+#include "stub-gbm.h"
+#include "tool-platform.h"
+#include "egl-gbm-ext.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <drm_fourcc.h>
+#include <gbmint.h>
+
+static struct {
+    EGLExtDriver driver;
+    EGLExtPlatform platform;
+
+    PFNEGLINITIALIZEPROC Initialize;
+    PFNEGLTERMINATEPROC Terminate;
+    PFNEGLCREATEPLATFORMWINDOWSURFACEPROC CreatePlatformWindowSurface;
+    PFNEGLDESTROYSURFACEPROC DestroySurface;
+    PFN_EGL_GBM_SURFACE_ADD_FRONT_BUFFER_LOCK AddFrontBufferLock;
+    PFN_EGL_GBM_SURFACE_EXPORT_FRONT_BUFFER ExportFrontBuffer;
+    PFN_EGL_GBM_SURFACE_DISPATCH_EXPORT DispatchExport;
+
+    struct gbm_device *gbm;
+    EGLDisplay dpy;
+    struct gbm_surface *gbmSurf;
+    EGLSurface eglSurf;
+} test;
+
+#define CHECK(_cond)                                                    \
+    do {                                                                \
+        if (!(_cond)) {                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __func__, __LINE__, #_cond);                        \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+static bool
+LoadPlatform(const char *path)
+{
+    if (!ToolLoadPlatform(path, &test.driver, &test.platform)) return false;
+
+#define GET_HOOK(_field, _name) \
+    if (!(test._field = ToolGetHook(&test.platform, _name))) return false
+
+    GET_HOOK(Initialize, "eglInitialize");
+    GET_HOOK(Terminate, "eglTerminate");
+    GET_HOOK(CreatePlatformWindowSurface, "eglCreatePlatformWindowSurface");
+    GET_HOOK(DestroySurface, "eglDestroySurface");
+
+#undef GET_HOOK
+
+    test.AddFrontBufferLock =
+        ToolGetPlatformSymbol("egl_gbm_surface_add_front_buffer_lock");
+    test.ExportFrontBuffer =
+        ToolGetPlatformSymbol("egl_gbm_surface_export_front_buffer");
+    test.DispatchExport =
+        ToolGetPlatformSymbol("egl_gbm_surface_dispatch_export");
+
+    return test.AddFrontBufferLock && test.ExportFrontBuffer &&
+           test.DispatchExport;
+}
+
+static bool
+CreateDisplay(void)
+{
+    EGLint major, minor;
+
+    CHECK(test.gbm = StubGbmCreateDevice());
+
+    test.dpy = test.platform.exports.getPlatformDisplay(
+        test.platform.data, EGL_PLATFORM_GBM_KHR, test.gbm, NULL);
+
+    CHECK(test.dpy != EGL_NO_DISPLAY);
+    CHECK(test.Initialize(test.dpy, &major, &minor));
+
+    return true;
+}
+
+static bool
+CreateSurface(void)
+{
+    if (!test.gbmSurf) {
+        test.gbmSurf = StubGbmCreateSurface(test.gbm, 64, 64,
+                                            DRM_FORMAT_XRGB8888,
+                                            GBM_BO_USE_RENDERING |
+                                            GBM_BO_USE_SCANOUT,
+                                            NULL, 0);
+        CHECK(test.gbmSurf);
+    }
+
+    test.eglSurf = test.CreatePlatformWindowSurface(test.dpy,
+                                                    StubEglAnyConfig(),
+                                                    test.gbmSurf, NULL);
+    CHECK(test.eglSurf != EGL_NO_SURFACE);
+
+    return true;
+}
+
+static void
+DestroyDisplay(void)
+{
+    if (test.gbmSurf) StubGbmDestroySurface(test.gbmSurf);
+    test.gbmSurf = NULL;
+
+    StubGbmDestroyDevice(test.gbm);
+    test.gbm = NULL;
+}
+
+static struct gbm_bo *
+PresentAndLock(void)
+{
+    if (!StubEglStreamPresent(StubEglLastStream())) return NULL;
+
+    return test.gbm->v0.surface_lock_front_buffer(test.gbmSurf);
+}
+
+/* Checks gbm_surface calls on a surface whose window surface is gone */
+static bool
+CheckDetached(struct gbm_bo *bo)
+{
+    CHECK(!test.gbm->v0.surface_has_free_buffers(test.gbmSurf));
+    CHECK(!test.gbm->v0.surface_lock_front_buffer(test.gbmSurf));
+    CHECK(test.AddFrontBufferLock(test.gbmSurf, bo) == -EINVAL);
+
+    /* Frames still locked are released by then, so this must do nothing */
+    test.gbm->v0.surface_release_buffer(test.gbmSurf, bo);
+
+    return true;
+}
+
+static bool
+TestLockTerminateRelease(void)
+{
+    struct gbm_bo *bo;
+
+    CHECK(CreateDisplay() && CreateSurface());
+    CHECK(bo = PresentAndLock());
+
+    CHECK(test.Terminate(test.dpy));
+    CHECK(StubGbmLiveBos() == 0);
+    CHECK(CheckDetached(bo));
+
+    DestroyDisplay();
+
+    return true;
+}
+
+static bool
+TestLockDestroyRelease(void)
+{
+    struct gbm_bo *bo;
+
+    CHECK(CreateDisplay() && CreateSurface());
+    CHECK(bo = PresentAndLock());
+    CHECK(test.AddFrontBufferLock(test.gbmSurf, bo) == 0);
+
+    CHECK(test.DestroySurface(test.dpy, test.eglSurf));
+    CHECK(CheckDetached(bo));
+
+    CHECK(test.Terminate(test.dpy));
+    CHECK(StubGbmLiveBos() == 0);
+
+    DestroyDisplay();
+
+    return true;
+}
+
+static bool
+TestRecreateAfterTerminate(void)
+{
+    struct gbm_bo *bo;
+
+    CHECK(CreateDisplay() && CreateSurface());
+    CHECK(bo = PresentAndLock());
+    CHECK(test.Terminate(test.dpy));
+
+    /* A new window surface on the same gbm_surface takes over from the old */
+    CHECK(test.Initialize(test.dpy, NULL, NULL));
+    CHECK(CreateSurface());
+    CHECK(bo = PresentAndLock());
+    test.gbm->v0.surface_release_buffer(test.gbmSurf, bo);
+    CHECK(test.gbm->v0.surface_has_free_buffers(test.gbmSurf));
+
+    CHECK(test.Terminate(test.dpy));
+    CHECK(StubGbmLiveBos() == 0);
+
+    DestroyDisplay();
+
+    return true;
+}
+
+/*
+ * Receives one export message of <size> bytes into <msg> on <sock>. Returns
+ * the number of fds that came with it, closing them, or -1 on error.
+ */
+static int
+ReceiveExport(int sock, void *msg, size_t size)
+{
+    char control[CMSG_SPACE(4 * sizeof(int))];
+    struct iovec iov = { msg, size };
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+    int fds[4];
+    int numFds = 0;
+    int i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &hdr, MSG_DONTWAIT) != (ssize_t)size) return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), numFds * sizeof(int));
+    }
+
+    for (i = 0; i < numFds; i++) close(fds[i]);
+
+    return numFds;
+}
+
+/* Receives and releases one exported frame */
+static bool
+ReceiveFrame(int sock, uint32_t *slot)
+{
+    struct egl_gbm_export_frame frame;
+    int numFds = ReceiveExport(sock, &frame, sizeof(frame));
+
+    /* The stub driver exports every acquire fence */
+    CHECK(frame.type == EGL_GBM_EXPORT_FRAME);
+    CHECK(frame.flags & EGL_GBM_EXPORT_FRAME_FENCE);
+    CHECK(numFds == 1);
+
+    *slot = frame.slot;
+    frame.type = EGL_GBM_EXPORT_RELEASE;
+    CHECK(send(sock, &frame, sizeof(frame), 0) == sizeof(frame));
+
+    return true;
+}
+
+static bool
+TestExportSocketReuse(void)
+{
+    struct egl_gbm_export_buffer buffer;
+    struct gbm_bo *bo;
+    uint32_t slot, slot2;
+    int socks[2], socks2[2];
+
+    CHECK(CreateDisplay() && CreateSurface());
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks) == 0);
+
+    CHECK(bo = PresentAndLock());
+    CHECK(test.ExportFrontBuffer(test.gbmSurf, bo, socks[0]) == 0);
+    test.gbm->v0.surface_release_buffer(test.gbmSurf, bo);
+
+    CHECK(ReceiveExport(socks[1], &buffer, sizeof(buffer)) == 1);
+    CHECK(buffer.type == EGL_GBM_EXPORT_BUFFER);
+    CHECK(ReceiveFrame(socks[1], &slot));
+    CHECK(slot == buffer.slot);
+    CHECK(test.DispatchExport(test.gbmSurf, socks[0]) == 1);
+
+    /* A new receiver on the same fd number must be sent the buffer again */
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks2) == 0);
+    CHECK(dup2(socks2[0], socks[0]) == socks[0]);
+    close(socks2[0]);
+    close(socks[1]);
+
+    do {
+        CHECK(bo = PresentAndLock());
+        CHECK(test.ExportFrontBuffer(test.gbmSurf, bo, socks[0]) == 0);
+        test.gbm->v0.surface_release_buffer(test.gbmSurf, bo);
+
+        CHECK(ReceiveExport(socks2[1], &buffer, sizeof(buffer)) == 1);
+        CHECK(buffer.type == EGL_GBM_EXPORT_BUFFER);
+        CHECK(ReceiveFrame(socks2[1], &slot2));
+        CHECK(test.DispatchExport(test.gbmSurf, socks[0]) == 1);
+    } while (slot2 != slot);
+
+    close(socks[0]);
+    close(socks2[1]);
+
+    CHECK(test.Terminate(test.dpy));
+    DestroyDisplay();
+
+    return true;
+}
+
+static const struct {
+    const char *name;
+    bool (*func)(void);
+} tests[] = {
+    { "lock-terminate-release", TestLockTerminateRelease },
+    { "lock-destroy-release", TestLockDestroyRelease },
+    { "recreate-after-terminate", TestRecreateAfterTerminate },
+    { "export-socket-reuse", TestExportSocketReuse },
+};
+
+int
+main(int argc, char **argv)
+{
+    const char *library = TOOL_DEFAULT_PLATFORM;
+    unsigned int i, failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        switch (opt) {
+        case 'l':
+            library = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc) goto usage;
+
+    /* Leave frame fences to the consumer, so exports carry them */
+    setenv("EGL_GBM_DEFER_ACQUIRE_WAIT", "1", 1);
+
+    if (!LoadPlatform(library)) return 1;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        bool ok = tests[i].func();
+
+        printf("%s: %s\n", tests[i].name, ok ? "ok" : "FAILED");
+        if (!ok) failed++;
+    }
+
+    test.platform.exports.unloadEGLExternalPlatform(test.platform.data);
+
+    return failed ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-l platform-library]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,789 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "stub-egl.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <drm_fourcc.h>
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+
+#ifndef EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV
+#define EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV 0x3378
+#endif
+
+#define STUB_STREAM_MAX_EVENTS 64
+#define STUB_IMAGE_STRIDE 16384
+
+/* Any file will do as long as the fake gbm device's fd refers to it too */
+#define STUB_DEVICE_PATH "/dev/null"
+
+enum {
+    IMAGE_FREE,
+    IMAGE_READY,
+    IMAGE_ACQUIRED,
+};
+
+typedef struct StubStreamRec StubStream;
+
+typedef struct StubImageRec {
+    StubStream *stream;
+    bool bound;
+    int state;
+    /* Created from dma-bufs rather than bound to a stream */
+    bool dmaBuf;
+} StubImage;
+
+struct StubStreamRec {
+    StubImage images[STUB_STREAM_IMAGES];
+
+    struct {
+        EGLenum event;
+        EGLAttrib aux;
+    } events[STUB_STREAM_MAX_EVENTS];
+    unsigned int eventHead;
+    unsigned int eventCount;
+
+    StubImage *ready[STUB_STREAM_IMAGES];
+    unsigned int readyHead;
+    unsigned int readyCount;
+
+    /* Frames presented so far, as EGL_PRODUCER_FRAME_KHR */
+    EGLuint64KHR producerFrame;
+};
+
+typedef struct StubConfigRec {
+    EGLint id;
+    EGLint r, g, b, a;
+    EGLint surfaceType;
+    EGLint componentType;
+} StubConfig;
+
+static const StubConfig stubConfigs[] = {
+    { 1, 8, 8, 8, 0, EGL_STREAM_BIT_KHR | EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT },
+    { 2, 8, 8, 8, 8, EGL_STREAM_BIT_KHR | EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT },
+    { 3, 5, 6, 5, 0, EGL_STREAM_BIT_KHR | EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT },
+    { 4, 10, 10, 10, 2, EGL_STREAM_BIT_KHR | EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT },
+    { 5, 16, 16, 16, 16, EGL_STREAM_BIT_KHR | EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT },
+    { 6, 8, 8, 8, 8, EGL_PBUFFER_BIT,
+      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT },
+};
+
+static int stubDisplay;
+static int stubDevice;
+static StubStream *lastStream;
+static unsigned long errorCount;
+static unsigned long dmaBufImages;
+
+static bool
+QueueEvent(StubStream *stream, EGLenum event, EGLAttrib aux)
+{
+    unsigned int idx;
+
+    if (stream->eventCount == STUB_STREAM_MAX_EVENTS) return false;
+
+    idx = (stream->eventHead + stream->eventCount) % STUB_STREAM_MAX_EVENTS;
+    stream->events[idx].event = event;
+    stream->events[idx].aux = aux;
+    stream->eventCount++;
+
+    return true;
+}
+
+EGLStreamKHR
+StubEglLastStream(void)
+{
+    return lastStream;
+}
+
+bool
+StubEglStreamPresent(EGLStreamKHR streamHandle)
+{
+    StubStream *stream = streamHandle;
+    unsigned int i;
+
+    if (!stream) return false;
+
+    for (i = 0; i < STUB_STREAM_IMAGES; i++) {
+        StubImage *img = &stream->images[i];
+
+        if (!img->bound || img->state != IMAGE_FREE) continue;
+
+        if (!QueueEvent(stream, EGL_STREAM_IMAGE_AVAILABLE_NV, 0))
+            return false;
+
+        img->state = IMAGE_READY;
+        stream->ready[(stream->readyHead + stream->readyCount) %
+                      STUB_STREAM_IMAGES] = img;
+        stream->readyCount++;
+        stream->producerFrame++;
+
+        return true;
+    }
+
+    return false;
+}
+
+EGLConfig
+StubEglAnyConfig(void)
+{
+    return (EGLConfig)&stubConfigs[0];
+}
+
+unsigned long
+StubEglErrorCount(void)
+{
+    return errorCount;
+}
+
+static EGLBoolean
+StubSetError(EGLint error, EGLint msgType, const char *format, ...)
+{
+    (void)error;
+    (void)msgType;
+    (void)format;
+
+    errorCount++;
+
+    return EGL_TRUE;
+}
+
+/* Display and device entry points */
+
+static const char *EGLAPIENTRY
+StubQueryString(EGLDisplay dpy, EGLint name)
+{
+    if (name == EGL_VERSION) return "1.5";
+    if (name != EGL_EXTENSIONS) return NULL;
+
+    if (dpy == EGL_NO_DISPLAY) {
+        return "EGL_EXT_platform_base EGL_EXT_device_base "
+               "EGL_EXT_device_enumeration EGL_EXT_device_query "
+               "EGL_KHR_client_get_all_proc_addresses "
+               "EGL_EXT_client_extensions EGL_KHR_debug "
+               "EGL_KHR_platform_x11 EGL_EXT_platform_x11 "
+               "EGL_EXT_platform_device EGL_MESA_platform_surfaceless "
+               "EGL_KHR_platform_wayland EGL_EXT_platform_wayland "
+               "EGL_KHR_platform_gbm EGL_MESA_platform_gbm "
+               "EGL_EXT_platform_xcb EGL_KHR_display_reference "
+               "EGL_EXT_explicit_device";
+    }
+
+    /* As long as a real driver's, so parsing it costs what it would there */
+    return "EGL_ANDROID_native_fence_sync EGL_EXT_buffer_age "
+           "EGL_EXT_client_sync EGL_EXT_create_context_robustness "
+           "EGL_EXT_image_dma_buf_import "
+           "EGL_EXT_image_dma_buf_import_modifiers EGL_EXT_output_base "
+           "EGL_EXT_output_drm EGL_EXT_protected_content "
+           "EGL_EXT_stream_consumer_egloutput EGL_EXT_stream_acquire_mode "
+           "EGL_EXT_sync_reuse EGL_IMG_context_priority "
+           "EGL_KHR_config_attribs EGL_KHR_create_context "
+           "EGL_KHR_create_context_no_error EGL_KHR_fence_sync "
+           "EGL_KHR_get_all_proc_addresses EGL_KHR_partial_update "
+           "EGL_KHR_swap_buffers_with_damage EGL_KHR_no_config_context "
+           "EGL_KHR_gl_colorspace EGL_KHR_gl_renderbuffer_image "
+           "EGL_KHR_gl_texture_2D_image EGL_KHR_gl_texture_3D_image "
+           "EGL_KHR_gl_texture_cubemap_image EGL_KHR_image "
+           "EGL_KHR_image_base EGL_KHR_reusable_sync EGL_KHR_stream "
+           "EGL_KHR_stream_attrib EGL_KHR_stream_consumer_gltexture "
+           "EGL_KHR_stream_cross_process_fd EGL_KHR_stream_fifo "
+           "EGL_KHR_stream_producer_eglsurface "
+           "EGL_KHR_surfaceless_context EGL_KHR_wait_sync "
+           "EGL_MESA_image_dma_buf_export EGL_NV_nvrm_fence_sync "
+           "EGL_NV_quadruple_buffer EGL_NV_stream_consumer_eglimage "
+           "EGL_NV_stream_consumer_eglimage_use_scanout_attrib "
+           "EGL_NV_stream_cross_display EGL_NV_stream_cross_object "
+           "EGL_NV_stream_cross_process EGL_NV_stream_cross_system "
+           "EGL_NV_stream_dma EGL_NV_stream_fifo_next "
+           "EGL_NV_stream_fifo_synchronous EGL_NV_stream_frame_limits "
+           "EGL_NV_stream_metadata EGL_NV_stream_remote "
+           "EGL_NV_stream_reset EGL_NV_stream_socket "
+           "EGL_NV_stream_socket_unix EGL_NV_stream_sync "
+           "EGL_NV_stream_flush EGL_NV_robustness_video_memory_purge "
+           "EGL_WL_bind_wayland_display";
+}
+
+static EGLBoolean EGLAPIENTRY
+StubQueryDevicesEXT(EGLint maxDevices, EGLDeviceEXT *devices, EGLint *numDevices)
+{
+    if (devices && maxDevices > 0) {
+        devices[0] = (EGLDeviceEXT)&stubDevice;
+        *numDevices = 1;
+    } else {
+        *numDevices = 1;
+    }
+
+    return EGL_TRUE;
+}
+
+static const char *EGLAPIENTRY
+StubQueryDeviceStringEXT(EGLDeviceEXT device, EGLint name)
+{
+    if (device != (EGLDeviceEXT)&stubDevice) return NULL;
+
+    switch (name) {
+    case EGL_EXTENSIONS:
+        return "EGL_EXT_device_drm EGL_EXT_device_drm_render_node";
+    case EGL_DRM_DEVICE_FILE_EXT:
+    case EGL_DRM_RENDER_NODE_FILE_EXT:
+        return STUB_DEVICE_PATH;
+    default:
+        return NULL;
+    }
+}
+
+static EGLBoolean EGLAPIENTRY
+StubQueryDisplayAttribEXT(EGLDisplay dpy, EGLint attribute, EGLAttrib *value)
+{
+    (void)dpy;
+    (void)attribute;
+    (void)value;
+
+    return EGL_FALSE;
+}
+
+static EGLDisplay EGLAPIENTRY
+StubGetPlatformDisplay(EGLenum platform,
+                       void *nativeDisplay,
+                       const EGLAttrib *attribs)
+{
+    (void)attribs;
+
+    if (platform != EGL_PLATFORM_DEVICE_EXT ||
+        nativeDisplay != (void *)&stubDevice)
+        return EGL_NO_DISPLAY;
+
+    return (EGLDisplay)&stubDisplay;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+    (void)dpy;
+
+    if (major) *major = 1;
+    if (minor) *minor = 5;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubTerminate(EGLDisplay dpy)
+{
+    (void)dpy;
+
+    return EGL_TRUE;
+}
+
+static EGLint EGLAPIENTRY
+StubGetError(void)
+{
+    return EGL_SUCCESS;
+}
+
+/* Config entry points */
+
+static bool
+GetStubConfigAttrib(const StubConfig *cfg, EGLint attribute, EGLint *value)
+{
+    switch (attribute) {
+    case EGL_CONFIG_ID: *value = cfg->id; return true;
+    case EGL_RED_SIZE: *value = cfg->r; return true;
+    case EGL_GREEN_SIZE: *value = cfg->g; return true;
+    case EGL_BLUE_SIZE: *value = cfg->b; return true;
+    case EGL_ALPHA_SIZE: *value = cfg->a; return true;
+    case EGL_SURFACE_TYPE: *value = cfg->surfaceType; return true;
+    case EGL_COLOR_COMPONENT_TYPE_EXT: *value = cfg->componentType; return true;
+    default: *value = 0; return true;
+    }
+}
+
+static bool
+ConfigMatches(const StubConfig *cfg, const EGLint *attribs)
+{
+    EGLint value;
+    int i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i + 1] == EGL_DONT_CARE) continue;
+
+        GetStubConfigAttrib(cfg, attribs[i], &value);
+
+        switch (attribs[i]) {
+        case EGL_RED_SIZE:
+        case EGL_GREEN_SIZE:
+        case EGL_BLUE_SIZE:
+        case EGL_ALPHA_SIZE:
+            if (value < attribs[i + 1]) return false;
+            break;
+        case EGL_SURFACE_TYPE:
+            if ((value & attribs[i + 1]) != attribs[i + 1]) return false;
+            break;
+        case EGL_CONFIG_ID:
+        case EGL_COLOR_COMPONENT_TYPE_EXT:
+            if (value != attribs[i + 1]) return false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubChooseConfig(EGLDisplay dpy,
+                 const EGLint *attribs,
+                 EGLConfig *configs,
+                 EGLint configSize,
+                 EGLint *numConfig)
+{
+    unsigned int i;
+    EGLint n = 0;
+
+    (void)dpy;
+
+    for (i = 0; i < ARRAY_LEN(stubConfigs); i++) {
+        if (!ConfigMatches(&stubConfigs[i], attribs)) continue;
+
+        if (configs) {
+            if (n >= configSize) break;
+            configs[n] = (EGLConfig)&stubConfigs[i];
+        }
+        n++;
+    }
+
+    *numConfig = n;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubGetConfigs(EGLDisplay dpy,
+               EGLConfig *configs,
+               EGLint configSize,
+               EGLint *numConfig)
+{
+    return StubChooseConfig(dpy, NULL, configs, configSize, numConfig);
+}
+
+static EGLBoolean EGLAPIENTRY
+StubGetConfigAttrib(EGLDisplay dpy,
+                    EGLConfig config,
+                    EGLint attribute,
+                    EGLint *value)
+{
+    const StubConfig *cfg = config;
+
+    (void)dpy;
+
+    if (cfg < &stubConfigs[0] || cfg >= &stubConfigs[ARRAY_LEN(stubConfigs)])
+        return EGL_FALSE;
+
+    return GetStubConfigAttrib(cfg, attribute, value) ? EGL_TRUE : EGL_FALSE;
+}
+
+/* Surface entry points */
+
+static EGLSurface EGLAPIENTRY
+StubCreatePbufferSurface(EGLDisplay dpy,
+                         EGLConfig config,
+                         const EGLint *attribs)
+{
+    (void)dpy;
+    (void)config;
+    (void)attribs;
+
+    return (EGLSurface)malloc(1);
+}
+
+static EGLSurface EGLAPIENTRY
+StubCreateStreamProducerSurfaceKHR(EGLDisplay dpy,
+                                   EGLConfig config,
+                                   EGLStreamKHR stream,
+                                   const EGLint *attribs)
+{
+    (void)dpy;
+    (void)config;
+    (void)stream;
+    (void)attribs;
+
+    return (EGLSurface)malloc(1);
+}
+
+static EGLBoolean EGLAPIENTRY
+StubDestroySurface(EGLDisplay dpy, EGLSurface surface)
+{
+    (void)dpy;
+
+    free(surface);
+
+    return EGL_TRUE;
+}
+
+/* Stream entry points */
+
+static EGLStreamKHR EGLAPIENTRY
+StubCreateStreamKHR(EGLDisplay dpy, const EGLint *attribs)
+{
+    StubStream *stream = calloc(1, sizeof(*stream));
+    unsigned int i;
+
+    (void)dpy;
+    (void)attribs;
+
+    if (!stream) return EGL_NO_STREAM_KHR;
+
+    for (i = 0; i < STUB_STREAM_IMAGES; i++)
+        stream->images[i].stream = stream;
+
+    lastStream = stream;
+
+    return (EGLStreamKHR)stream;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubDestroyStreamKHR(EGLDisplay dpy, EGLStreamKHR stream)
+{
+    (void)dpy;
+
+    if (lastStream == stream) lastStream = NULL;
+
+    free(stream);
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubStreamImageConsumerConnectNV(EGLDisplay dpy,
+                                 EGLStreamKHR streamHandle,
+                                 EGLint numModifiers,
+                                 const EGLuint64KHR *modifiers,
+                                 const EGLAttrib *attribs)
+{
+    StubStream *stream = streamHandle;
+    unsigned int i;
+
+    (void)dpy;
+    (void)numModifiers;
+    (void)modifiers;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i] != EGL_STREAM_CONSUMER_IMAGE_USE_SCANOUT_NV)
+            return EGL_FALSE;
+    }
+
+    for (i = 0; i < STUB_STREAM_IMAGES; i++)
+        QueueEvent(stream, EGL_STREAM_IMAGE_ADD_NV, 0);
+
+    return EGL_TRUE;
+}
+
+static EGLint EGLAPIENTRY
+StubQueryStreamConsumerEventNV(EGLDisplay dpy,
+                               EGLStreamKHR streamHandle,
+                               EGLTime timeout,
+                               EGLenum *event,
+                               EGLAttrib *aux)
+{
+    StubStream *stream = streamHandle;
+
+    (void)dpy;
+    (void)timeout;
+
+    if (!stream->eventCount) return EGL_TIMEOUT_EXPIRED_KHR;
+
+    *event = stream->events[stream->eventHead].event;
+    *aux = stream->events[stream->eventHead].aux;
+    stream->eventHead = (stream->eventHead + 1) % STUB_STREAM_MAX_EVENTS;
+    stream->eventCount--;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubQueryStreamu64KHR(EGLDisplay dpy,
+                      EGLStreamKHR streamHandle,
+                      EGLenum attribute,
+                      EGLuint64KHR *value)
+{
+    StubStream *stream = streamHandle;
+
+    (void)dpy;
+
+    if (!stream || attribute != EGL_PRODUCER_FRAME_KHR) return EGL_FALSE;
+
+    *value = stream->producerFrame;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubStreamAcquireImageNV(EGLDisplay dpy,
+                         EGLStreamKHR streamHandle,
+                         EGLImage *image,
+                         EGLSync sync)
+{
+    StubStream *stream = streamHandle;
+    StubImage *img;
+
+    (void)dpy;
+    (void)sync;
+
+    if (!stream->readyCount) return EGL_FALSE;
+
+    img = stream->ready[stream->readyHead];
+    stream->readyHead = (stream->readyHead + 1) % STUB_STREAM_IMAGES;
+    stream->readyCount--;
+
+    img->state = IMAGE_ACQUIRED;
+    *image = (EGLImage)img;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubStreamReleaseImageNV(EGLDisplay dpy,
+                         EGLStreamKHR stream,
+                         EGLImage image,
+                         EGLSync sync)
+{
+    StubImage *img = image;
+
+    (void)dpy;
+    (void)stream;
+    (void)sync;
+
+    img->state = IMAGE_FREE;
+
+    return EGL_TRUE;
+}
+
+/* Image entry points */
+
+static EGLImageKHR EGLAPIENTRY
+StubCreateImageKHR(EGLDisplay dpy,
+                   EGLContext ctx,
+                   EGLenum target,
+                   EGLClientBuffer buffer,
+                   const EGLint *attribs)
+{
+    StubStream *stream = (StubStream *)buffer;
+    unsigned int i;
+
+    (void)dpy;
+    (void)ctx;
+    (void)attribs;
+
+    if (target == EGL_LINUX_DMA_BUF_EXT) {
+        StubImage *img = calloc(1, sizeof(*img));
+
+        if (!img) return EGL_NO_IMAGE_KHR;
+
+        img->dmaBuf = true;
+        dmaBufImages++;
+
+        return (EGLImageKHR)img;
+    }
+
+    if (target != EGL_STREAM_CONSUMER_IMAGE_NV) return EGL_NO_IMAGE_KHR;
+
+    for (i = 0; i < STUB_STREAM_IMAGES; i++) {
+        if (!stream->images[i].bound) {
+            stream->images[i].bound = true;
+            stream->images[i].state = IMAGE_FREE;
+            return (EGLImageKHR)&stream->images[i];
+        }
+    }
+
+    return EGL_NO_IMAGE_KHR;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubDestroyImageKHR(EGLDisplay dpy, EGLImageKHR image)
+{
+    StubImage *img = image;
+
+    (void)dpy;
+
+    if (img->dmaBuf) {
+        dmaBufImages--;
+        free(img);
+        return EGL_TRUE;
+    }
+
+    img->bound = false;
+    img->state = IMAGE_FREE;
+
+    return EGL_TRUE;
+}
+
+static EGLImage EGLAPIENTRY
+StubCreateImage(EGLDisplay dpy,
+                EGLContext ctx,
+                EGLenum target,
+                EGLClientBuffer buffer,
+                const EGLAttrib *attribs)
+{
+    (void)attribs;
+
+    /* None of the stub's image targets take attributes */
+    return StubCreateImageKHR(dpy, ctx, target, buffer, NULL);
+}
+
+unsigned long
+StubEglDmaBufImages(void)
+{
+    return dmaBufImages;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubExportDMABUFImageQueryMESA(EGLDisplay dpy,
+                               EGLImageKHR image,
+                               int *fourcc,
+                               int *numPlanes,
+                               EGLuint64KHR *modifiers)
+{
+    (void)dpy;
+    (void)image;
+
+    if (fourcc) *fourcc = DRM_FORMAT_XRGB8888;
+    if (numPlanes) *numPlanes = 1;
+    if (modifiers) *modifiers = DRM_FORMAT_MOD_LINEAR;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean EGLAPIENTRY
+StubExportDMABUFImageMESA(EGLDisplay dpy,
+                          EGLImageKHR image,
+                          int *fds,
+                          EGLint *strides,
+                          EGLint *offsets)
+{
+    (void)dpy;
+    (void)image;
+
+    fds[0] = open(STUB_DEVICE_PATH, O_RDONLY | O_CLOEXEC);
+    if (strides) strides[0] = STUB_IMAGE_STRIDE;
+    if (offsets) offsets[0] = 0;
+
+    return fds[0] >= 0 ? EGL_TRUE : EGL_FALSE;
+}
+
+/* Sync entry points */
+
+static EGLSyncKHR EGLAPIENTRY
+StubCreateSyncKHR(EGLDisplay dpy, EGLenum type, const EGLint *attribs)
+{
+    (void)dpy;
+    (void)type;
+    (void)attribs;
+
+    return (EGLSyncKHR)malloc(1);
+}
+
+static EGLBoolean EGLAPIENTRY
+StubDestroySyncKHR(EGLDisplay dpy, EGLSyncKHR sync)
+{
+    (void)dpy;
+
+    free(sync);
+
+    return EGL_TRUE;
+}
+
+static EGLint EGLAPIENTRY
+StubClientWaitSyncKHR(EGLDisplay dpy,
+                      EGLSyncKHR sync,
+                      EGLint flags,
+                      EGLTimeKHR timeout)
+{
+    (void)dpy;
+    (void)sync;
+    (void)flags;
+    (void)timeout;
+
+    return EGL_CONDITION_SATISFIED_KHR;
+}
+
+/* Stub fences are always signaled, like a readable eventfd polls */
+static EGLint EGLAPIENTRY
+StubDupNativeFenceFDANDROID(EGLDisplay dpy, EGLSyncKHR sync)
+{
+    (void)dpy;
+    (void)sync;
+
+    return eventfd(1, EFD_CLOEXEC);
+}
+
+typedef struct StubProcRec {
+    const char *name;
+    void *func;
+} StubProc;
+
+static const StubProc stubProcs[] = {
+    { "eglChooseConfig", StubChooseConfig },
+    { "eglClientWaitSyncKHR", StubClientWaitSyncKHR },
+    { "eglCreateImage", StubCreateImage },
+    { "eglCreateImageKHR", StubCreateImageKHR },
+    { "eglCreatePbufferSurface", StubCreatePbufferSurface },
+    { "eglCreateStreamKHR", StubCreateStreamKHR },
+    { "eglCreateStreamProducerSurfaceKHR", StubCreateStreamProducerSurfaceKHR },
+    { "eglCreateSyncKHR", StubCreateSyncKHR },
+    { "eglDestroyImageKHR", StubDestroyImageKHR },
+    { "eglDestroyStreamKHR", StubDestroyStreamKHR },
+    { "eglDestroySurface", StubDestroySurface },
+    { "eglDestroySyncKHR", StubDestroySyncKHR },
+    { "eglDupNativeFenceFDANDROID", StubDupNativeFenceFDANDROID },
+    { "eglExportDMABUFImageMESA", StubExportDMABUFImageMESA },
+    { "eglExportDMABUFImageQueryMESA", StubExportDMABUFImageQueryMESA },
+    { "eglGetConfigAttrib", StubGetConfigAttrib },
+    { "eglGetConfigs", StubGetConfigs },
+    { "eglGetError", StubGetError },
+    { "eglGetPlatformDisplay", StubGetPlatformDisplay },
+    { "eglInitialize", StubInitialize },
+    { "eglQueryDevicesEXT", StubQueryDevicesEXT },
+    { "eglQueryDeviceStringEXT", StubQueryDeviceStringEXT },
+    { "eglQueryDisplayAttribEXT", StubQueryDisplayAttribEXT },
+    { "eglQueryStreamConsumerEventNV", StubQueryStreamConsumerEventNV },
+    { "eglQueryStreamu64KHR", StubQueryStreamu64KHR },
+    { "eglQueryString", StubQueryString },
+    { "eglStreamAcquireImageNV", StubStreamAcquireImageNV },
+    { "eglStreamImageConsumerConnectNV", StubStreamImageConsumerConnectNV },
+    { "eglStreamReleaseImageNV", StubStreamReleaseImageNV },
+    { "eglTerminate", StubTerminate },
+};
+
+static void *
+StubGetProcAddress(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LEN(stubProcs); i++) {
+        if (!strcmp(stubProcs[i].name, name)) return stubProcs[i].func;
+    }
+
+    return NULL;
+}
+
+void
+StubEglInitDriver(EGLExtDriver *driver)
+{
+    memset(driver, 0, sizeof(*driver));
+    driver->getProcAddress = StubGetProcAddress;
+    driver->setError = StubSetError;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STUB_EGL_H
+#define STUB_EGL_H
+
+#include <stdbool.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <eglexternalplatform.h>
+
+/*
+ * An in-process stand-in for the EGL driver, providing just enough of the
+ * device, config, stream, image, sync and dma-buf export entry points for the
+ * GBM platform to run its bookkeeping without a GPU.
+ *
+ * Streams own a fixed set of images, announced with EGL_STREAM_IMAGE_ADD_NV
+ * events when a consumer connects. Frames are produced explicitly with
+ * StubEglStreamPresent(), which makes a free image available to the consumer.
+ */
+
+/* Number of images each stub stream owns */
+#define STUB_STREAM_IMAGES 4
+
+void StubEglInitDriver(EGLExtDriver *driver);
+
+/* The stream most recently created through the stub driver */
+EGLStreamKHR StubEglLastStream(void);
+
+/*
+ * Simulates the producer finishing a frame on <stream>. Returns false if the
+ * consumer holds every image, i.e. the producer would block.
+ */
+bool StubEglStreamPresent(EGLStreamKHR stream);
+
+/* Any config, for callers that need one but have no way to choose it */
+EGLConfig StubEglAnyConfig(void);
+
+/* Number of live EGL_LINUX_DMA_BUF_EXT images */
+unsigned long StubEglDmaBufImages(void);
+
+/* Number of errors the platform has reported through EGLExtDriver::setError */
+unsigned long StubEglErrorCount(void);
+
+#endif /* STUB_EGL_H */
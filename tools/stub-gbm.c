@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "stub-gbm.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gbmint.h>
+
+/* Must match the EGLDevice paths reported by stub-egl.c */
+#define STUB_DEVICE_PATH "/dev/null"
+
+/*
+ * The NVIDIA gbm backend reserves the pointer immediately preceding each
+ * gbm_surface for use by the EGL platform.
+ */
+typedef struct StubGbmSurfaceRec {
+    void *platformPriv;
+    struct gbm_surface base;
+} StubGbmSurface;
+
+static unsigned long liveBos;
+
+static struct gbm_bo *
+StubBoImport(struct gbm_device *gbm, uint32_t type, void *buffer, uint32_t usage)
+{
+    const struct gbm_import_fd_modifier_data *data = buffer;
+    struct gbm_bo *bo;
+
+    (void)usage;
+
+    if (type != GBM_BO_IMPORT_FD_MODIFIER) return NULL;
+
+    bo = calloc(1, sizeof(*bo));
+
+    if (!bo) return NULL;
+
+    bo->gbm = gbm;
+    bo->v0.width = data->width;
+    bo->v0.height = data->height;
+    bo->v0.format = data->format;
+    bo->v0.stride = data->strides[0];
+    liveBos++;
+
+    return bo;
+}
+
+static int
+StubBoGetPlanes(struct gbm_bo *bo)
+{
+    (void)bo;
+
+    return 1;
+}
+
+static int
+StubBoGetPlaneFd(struct gbm_bo *bo, int plane)
+{
+    (void)bo;
+    (void)plane;
+
+    return open(STUB_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+}
+
+static uint32_t
+StubBoGetStride(struct gbm_bo *bo, int plane)
+{
+    (void)plane;
+
+    return bo->v0.stride;
+}
+
+static uint32_t
+StubBoGetOffset(struct gbm_bo *bo, int plane)
+{
+    (void)bo;
+    (void)plane;
+
+    return 0;
+}
+
+static uint64_t
+StubBoGetModifier(struct gbm_bo *bo)
+{
+    (void)bo;
+
+    return 0; /* DRM_FORMAT_MOD_LINEAR */
+}
+
+/*
+ * Maps the bo through a linear staging buffer, the way the NVIDIA backend
+ * maps block-linear buffers. The staging buffer is shared by all maps, which
+ * must not overlap, and reads as STUB_MAP_PATTERN.
+ */
+static void *
+StubBoMap(struct gbm_bo *bo, uint32_t x, uint32_t y,
+          uint32_t width, uint32_t height, uint32_t flags,
+          uint32_t *stride, void **mapData)
+{
+    static uint8_t *staging;
+    static size_t stagingSize;
+    size_t size = (size_t)bo->v0.stride * height;
+
+    (void)x;
+    (void)y;
+    (void)width;
+    (void)flags;
+
+    if (size > stagingSize) {
+        free(staging);
+        stagingSize = 0;
+
+        if (!(staging = malloc(size))) return NULL;
+
+        memset(staging, STUB_MAP_PATTERN, size);
+        stagingSize = size;
+    }
+
+    *stride = bo->v0.stride;
+    *mapData = NULL;
+
+    return staging;
+}
+
+static void
+StubBoUnmap(struct gbm_bo *bo, void *mapData)
+{
+    (void)bo;
+    (void)mapData;
+}
+
+static void
+StubBoDestroy(struct gbm_bo *bo)
+{
+    liveBos--;
+    free(bo);
+}
+
+struct gbm_device *
+StubGbmCreateDevice(void)
+{
+    struct gbm_device *gbm = calloc(1, sizeof(*gbm));
+
+    if (!gbm) return NULL;
+
+    gbm->dummy = gbm_create_device;
+    gbm->v0.name = "nvidia";
+    gbm->v0.fd = open(STUB_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+    gbm->v0.bo_import = StubBoImport;
+    gbm->v0.bo_get_planes = StubBoGetPlanes;
+    gbm->v0.bo_get_plane_fd = StubBoGetPlaneFd;
+    gbm->v0.bo_get_stride = StubBoGetStride;
+    gbm->v0.bo_get_offset = StubBoGetOffset;
+    gbm->v0.bo_get_modifier = StubBoGetModifier;
+    gbm->v0.bo_map = StubBoMap;
+    gbm->v0.bo_unmap = StubBoUnmap;
+    gbm->v0.bo_destroy = StubBoDestroy;
+
+    if (gbm->v0.fd < 0) {
+        free(gbm);
+        return NULL;
+    }
+
+    return gbm;
+}
+
+void
+StubGbmDestroyDevice(struct gbm_device *gbm)
+{
+    if (!gbm) return;
+
+    close(gbm->v0.fd);
+    free(gbm);
+}
+
+struct gbm_surface *
+StubGbmCreateSurface(struct gbm_device *gbm,
+                     uint32_t width,
+                     uint32_t height,
+                     uint32_t format,
+                     uint32_t flags,
+                     const uint64_t *modifiers,
+                     unsigned int count)
+{
+    StubGbmSurface *surf = calloc(1, sizeof(*surf));
+
+    if (!surf) return NULL;
+
+    surf->base.gbm = gbm;
+    surf->base.v0.width = width;
+    surf->base.v0.height = height;
+    surf->base.v0.format = format;
+    surf->base.v0.flags = flags;
+
+    if (count) {
+        surf->base.v0.modifiers = malloc(count * sizeof(*modifiers));
+
+        if (!surf->base.v0.modifiers) {
+            free(surf);
+            return NULL;
+        }
+
+        memcpy(surf->base.v0.modifiers, modifiers, count * sizeof(*modifiers));
+        surf->base.v0.count = count;
+    }
+
+    return &surf->base;
+}
+
+void
+StubGbmDestroySurface(struct gbm_surface *s)
+{
+    StubGbmSurface *surf;
+
+    if (!s) return;
+
+    surf = (StubGbmSurface *)((uint8_t *)s - offsetof(StubGbmSurface, base));
+    free(surf->base.v0.modifiers);
+    free(surf);
+}
+
+unsigned long
+StubGbmLiveBos(void)
+{
+    return liveBos;
+}
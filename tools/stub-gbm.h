@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STUB_GBM_H
+#define STUB_GBM_H
+
+#include <stdint.h>
+#include <gbm.h>
+
+/*
+ * Fake gbm devices and surfaces laid out the way the NVIDIA gbm backend lays
+ * them out, so the platform accepts them as its own. Buffer imports just
+ * allocate a gbm_bo with the imported dimensions.
+ */
+
+/* Every byte of a mapped buffer object reads as this */
+#define STUB_MAP_PATTERN 0x5a
+
+struct gbm_device *StubGbmCreateDevice(void);
+void StubGbmDestroyDevice(struct gbm_device *gbm);
+
+struct gbm_surface *StubGbmCreateSurface(struct gbm_device *gbm,
+                                         uint32_t width,
+                                         uint32_t height,
+                                         uint32_t format,
+                                         uint32_t flags,
+                                         const uint64_t *modifiers,
+                                         unsigned int count);
+void StubGbmDestroySurface(struct gbm_surface *s);
+
+/* Number of buffer objects imported but not yet destroyed */
+unsigned long StubGbmLiveBos(void);
+
+#endif /* STUB_GBM_H */
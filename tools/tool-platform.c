@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tool-platform.h"
+#include "stub-egl.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* The EGL external platform interface version the tools act as a driver for */
+#define TOOL_EXTERNAL_VERSION_MAJOR 1
+#define TOOL_EXTERNAL_VERSION_MINOR 1
+
+static void *platformLib;
+
+typedef EGLBoolean (*LoadPlatformFunc)(int major, int minor,
+                                       const EGLExtDriver *driver,
+                                       EGLExtPlatform *platform);
+
+bool
+ToolLoadPlatform(const char *path,
+                 EGLExtDriver *driver,
+                 EGLExtPlatform *platform)
+{
+    void *lib = platformLib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!lib) {
+        fprintf(stderr, "%s\n", dlerror());
+        return false;
+    }
+
+    if (!dlsym(lib, "loadEGLExternalPlatform")) {
+        fprintf(stderr, "%s is not an EGL external platform\n", path);
+        return false;
+    }
+
+    StubEglInitDriver(driver);
+
+    if (!ToolReloadPlatform(driver, platform)) {
+        fprintf(stderr, "Failed to load %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+ToolReloadPlatform(const EGLExtDriver *driver, EGLExtPlatform *platform)
+{
+    LoadPlatformFunc load =
+        (LoadPlatformFunc)ToolGetPlatformSymbol("loadEGLExternalPlatform");
+
+    if (!load) return false;
+
+    memset(platform, 0, sizeof(*platform));
+
+    return load(TOOL_EXTERNAL_VERSION_MAJOR, TOOL_EXTERNAL_VERSION_MINOR,
+                driver, platform);
+}
+
+void *
+ToolGetPlatformSymbol(const char *name)
+{
+    return platformLib ? dlsym(platformLib, name) : NULL;
+}
+
+void *
+ToolGetHook(const EGLExtPlatform *platform, const char *name)
+{
+    void *func = platform->exports.getHookAddress(platform->data, name);
+
+    if (!func) fprintf(stderr, "The platform does not hook %s\n", name);
+
+    return func;
+}
+
+uint64_t
+ToolNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TOOL_PLATFORM_H
+#define TOOL_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <eglexternalplatform.h>
+
+/* The library the tools load when none is given on the command line */
+#define TOOL_DEFAULT_PLATFORM "libnvidia-egl-gbm.so.1"
+
+/*
+ * Loads the GBM platform library at <path> with the stub EGL driver, filling
+ * in <driver> and <platform>. Errors are reported on stderr.
+ */
+bool ToolLoadPlatform(const char *path,
+                      EGLExtDriver *driver,
+                      EGLExtPlatform *platform);
+
+/*
+ * Calls loadEGLExternalPlatform() of the library loaded by ToolLoadPlatform()
+ * again, filling in a new <platform>. Unload it with its
+ * unloadEGLExternalPlatform export.
+ */
+bool ToolReloadPlatform(const EGLExtDriver *driver, EGLExtPlatform *platform);
+
+/* Looks up an exported symbol of the loaded platform library */
+void *ToolGetPlatformSymbol(const char *name);
+
+/* Looks up a hook the platform must provide, reporting on stderr if absent */
+void *ToolGetHook(const EGLExtPlatform *platform, const char *name);
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t ToolNow(void);
+
+#endif /* TOOL_PLATFORM_H */